@@ -0,0 +1,114 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "adaptivepacer.h"
+
+#include <algorithm>
+#include <thread>
+
+AdaptivePacer::AdaptivePacer(const Config& config) :
+  _config{config},
+  _rate{config.initial_rate},
+  _next_send{Clock::now()},
+  _last_increase{_next_send},
+  _last_decrease{_next_send},
+  _rto{config.initial_rto}
+{
+}
+
+void AdaptivePacer::pace(uint messages)
+{
+  std::this_thread::sleep_until(reserve(messages));
+}
+
+AdaptivePacer::Clock::time_point AdaptivePacer::reserve(uint messages)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  // Sleeping overshoots, so allow a sender that fell behind to catch up
+  // a little instead of losing its slots.
+  _next_send = std::max(_next_send, Clock::now() - _config.burst);
+  Clock::time_point slot = _next_send;
+  _next_send += std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>(messages / _rate));
+
+  return slot;
+}
+
+void AdaptivePacer::on_reply(Clock::duration rtt)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  if (_samples == 0) {
+    _srtt = rtt;
+    _rttvar = rtt / 2;
+  } else {
+    Clock::duration delta = _srtt > rtt ? _srtt - rtt : rtt - _srtt;
+    _rttvar = (3 * _rttvar + delta) / 4;
+    _srtt = (7 * _srtt + rtt) / 8;
+  }
+  ++_samples;
+  _rto = std::clamp<Clock::duration>(_srtt + 4 * _rttvar, _config.min_rto, _config.max_rto);
+
+  _increase(Clock::now());
+}
+
+void AdaptivePacer::on_reply()
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  _increase(Clock::now());
+}
+
+void AdaptivePacer::on_loss()
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  ++_losses;
+  _rto = std::min<Clock::duration>(2 * _rto, _config.max_rto);
+
+  // Losses within a round trip after a decrease are most likely caused by the
+  // same overload, they mustn't cut the rate again.
+  auto now = Clock::now();
+  if (now - _last_decrease >= std::max(_srtt, _config.min_increase_interval)) {
+    _rate = std::max(_rate * _config.decrease, _config.min_rate);
+    _last_decrease = now;
+    _last_increase = now;
+    ++_decreases;
+  }
+}
+
+AdaptivePacer::Clock::duration AdaptivePacer::timeout() const
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  return _rto;
+}
+
+AdaptivePacer::Stats AdaptivePacer::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  return Stats{_rate, _srtt, _rto, _samples, _losses, _decreases};
+}
+
+void AdaptivePacer::_increase(Clock::time_point now)
+{
+  // Additive increase once per round trip. A lower limit keeps the rate
+  // from exploding on links with sub-millisecond round trips.
+  if (now - _last_increase >= std::max(_srtt, _config.min_increase_interval)) {
+    _rate = std::min(_rate + _config.increase, _config.max_rate);
+    _last_increase = now;
+  }
+}
@@ -0,0 +1,124 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ADAPTIVEPACER_H
+#define ADAPTIVEPACER_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @brief Paces the messages sent to a mixer and provides retransmission timeouts.
+ *
+ * The send rate follows AIMD: it grows by a fixed amount per round trip while replies
+ * arrive and is cut by a factor on loss, at most once per round trip. That way it
+ * settles just below the highest rate the console sustains. The retransmission timeout
+ * is derived from smoothed RTT and RTT variance like TCP's (RFC 6298) and backs off
+ * exponentially while replies keep getting lost.
+ */
+class AdaptivePacer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Config {
+      double initial_rate;              // Messages per second to start with
+      double min_rate, max_rate;        // Limits of the send rate
+      double increase;                  // Rate increase per round trip in messages per second
+      double decrease;                  // Factor applied to the rate on loss
+      Clock::duration min_increase_interval;  // Lower limit for the round trip used for increases
+      Clock::duration burst;            // Time a sender may fall behind and catch up without pacing
+      Clock::duration initial_rto;      // Timeout before the first RTT sample
+      Clock::duration min_rto, max_rto; // Limits of the timeout
+
+      Config() :
+	initial_rate{100}, min_rate{10}, max_rate{20000}, increase{20}, decrease{0.5},
+	min_increase_interval{std::chrono::milliseconds(10)}, burst{std::chrono::milliseconds(2)},
+	initial_rto{std::chrono::milliseconds(200)}, min_rto{std::chrono::milliseconds(5)},
+	max_rto{std::chrono::seconds(1)} {}
+    };
+
+    struct Stats {
+      double rate;                  // Current send rate in messages per second
+      Clock::duration srtt;         // Smoothed round trip time
+      Clock::duration rto;          // Current retransmission timeout
+      uint64_t samples;             // RTT samples taken
+      uint64_t losses;              // Losses reported
+      uint64_t decreases;           // Rate decreases
+    };
+
+    explicit AdaptivePacer(const Config& config = Config());
+
+    /**
+     * @brief pace Wait until the next messages may be sent at the current rate.
+     * @param messages Number of messages about to be sent.
+     */
+    void pace(uint messages = 1);
+
+    /**
+     * @brief reserve Like pace() but without waiting, e.g. for callers that sleep
+     *        asynchronously.
+     * @param messages Number of messages about to be sent.
+     * @return The time they may be sent at.
+     */
+    Clock::time_point reserve(uint messages = 1);
+
+    /**
+     * @brief on_reply Report a reply. Increases the rate.
+     * @param rtt Time between sending the request and receiving the reply. Don't pass
+     *        the RTT of retransmitted requests, the reply might belong to an earlier
+     *        transmission (Karn's algorithm).
+     */
+    void on_reply(Clock::duration rtt);
+
+    /**
+     * @brief on_reply Report a reply without an RTT sample, e.g. to a retransmission.
+     */
+    void on_reply();
+
+    /**
+     * @brief on_loss Report a lost or timed out request. Decreases the rate and backs
+     *        off the timeout.
+     */
+    void on_loss();
+
+    /**
+     * @brief timeout Time to wait for a reply before retransmitting.
+     */
+    Clock::duration timeout() const;
+
+    /**
+     * @brief stats Current rate, RTT estimate and counters.
+     */
+    Stats stats() const;
+
+private:
+    Config _config;
+    mutable std::mutex _mtx;
+    double _rate;
+    Clock::time_point _next_send;
+    Clock::time_point _last_increase, _last_decrease;
+    Clock::duration _srtt{0}, _rttvar{0}, _rto;
+    uint64_t _samples = 0, _losses = 0, _decreases = 0;
+
+    void _increase(Clock::time_point now);
+};
+
+#endif // ADAPTIVEPACER_H
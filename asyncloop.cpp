@@ -0,0 +1,174 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "asyncloop.h"
+
+void AsyncPromiseBase::_finished(AsyncLoop* loop, std::exception_ptr error)
+{
+  loop->_finished(error);
+}
+
+AsyncLoop::AsyncLoop()
+{
+}
+
+AsyncLoop::~AsyncLoop()
+{
+  // Nothing to do here.
+}
+
+void AsyncLoop::spawn(AsyncTask<void> task)
+{
+  auto handle = std::exchange(task._handle, nullptr);
+  handle.promise().loop = this;
+  handle.promise().detached = true;
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    ++_tasks;
+  }
+  post(handle);
+}
+
+void AsyncLoop::run()
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  while (_tasks > 0) {
+    if (!_ready.empty()) {
+      auto handle = _ready.front();
+      _ready.pop_front();
+      lock.unlock();
+      handle.resume();
+      lock.lock();
+      continue;
+    }
+
+    if (!_timers.empty() && _timers.begin()->first <= Clock::now()) {
+      Timer* timer = _timers.begin()->second;
+      _disarm(timer);
+      lock.unlock();
+      timer->expire();
+      lock.lock();
+      continue;
+    }
+
+    if (_timers.empty()) {
+      _cv.wait(lock);
+    } else {
+      // A copy, other threads may remove the timer while we wait
+      Clock::time_point next = _timers.begin()->first;
+      _cv.wait_until(lock, next);
+    }
+  }
+
+  if (_error) {
+    std::rethrow_exception(std::exchange(_error, nullptr));
+  }
+}
+
+size_t AsyncLoop::tasks() const
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  return _tasks;
+}
+
+void AsyncLoop::post(std::coroutine_handle<> handle, Timer* cancel)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (cancel && cancel->_armed) {
+      _disarm(cancel);
+    }
+    _ready.push_back(handle);
+  }
+  _cv.notify_one();
+}
+
+void AsyncLoop::add_timer(Timer* timer, Clock::time_point at)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  timer->_pos = _timers.emplace(at, timer);
+  timer->_armed = true;
+}
+
+void AsyncLoop::expire_now(Timer* timer)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (!timer->_armed) {
+      return;
+    }
+    _timers.erase(timer->_pos);
+    timer->_pos = _timers.emplace(Clock::time_point::min(), timer);
+  }
+  _cv.notify_one();
+}
+
+void AsyncLoop::_finished(std::exception_ptr error)
+{
+  // Called on the loop's thread, which wakes up by itself
+  std::lock_guard<std::mutex> lock(_mtx);
+  --_tasks;
+  if (error && !_error) {
+    _error = error;
+  }
+}
+
+void AsyncLoop::_disarm(Timer* timer)
+{
+  _timers.erase(timer->_pos);
+  timer->_armed = false;
+}
+
+bool AsyncReply::await_resume()
+{
+  _on_stop.reset();
+  // Returns right away once notified. After a timeout it gives up the request,
+  // unless the reply has just arrived.
+  return _correlator.wait(_ticket, _reply, AsyncLoop::Clock::now());
+}
+
+bool AsyncReply::_suspend(AsyncLoop& loop, std::coroutine_handle<> handle)
+{
+  _loop = &loop;
+  _handle = handle;
+  // The loop runs on this thread, so the timer can't expire before we return.
+  loop.add_timer(this, _deadline);
+  if (!_correlator.arm(_ticket, this)) {
+    // The reply is in already
+    loop.post(handle, this);
+    return true;
+  }
+  _on_stop.emplace(_stop, Cancel{this});
+
+  return true;
+}
+
+void AsyncReply::expire()
+{
+  // If the server thread is notifying us right now it posts the task itself.
+  if (_correlator.disarm(_ticket, this)) {
+    _handle.resume();
+  }
+}
+
+void AsyncReply::notify()
+{
+  _loop->post(_handle, this);
+}
@@ -0,0 +1,314 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ASYNCLOOP_H
+#define ASYNCLOOP_H
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <utility>
+
+#include "replycorrelator.h"
+
+class AsyncLoop;
+
+/**
+ * @brief State shared by the promises of all AsyncTasks: the loop they run on and
+ *        the coroutine awaiting them.
+ */
+struct AsyncPromiseBase {
+    AsyncLoop* loop = nullptr;
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+    bool detached = false;   // Spawned on the loop, nobody awaits it
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+
+    // Resumes the awaiting coroutine, or frees a spawned task
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      template<typename Promise>
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+      {
+	AsyncPromiseBase& promise = handle.promise();
+	if (promise.detached) {
+	  AsyncLoop* loop = promise.loop;
+	  std::exception_ptr error = promise.error;
+	  handle.destroy();
+	  _finished(loop, error);
+	  return std::noop_coroutine();
+	}
+	return promise.continuation ? promise.continuation : std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+private:
+    static void _finished(AsyncLoop* loop, std::exception_ptr error);
+};
+
+template<typename T>
+struct AsyncPromise : AsyncPromiseBase {
+    std::optional<T> value;
+
+    template<typename U>
+    void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+    T result() { return std::move(*value); }
+};
+
+template<>
+struct AsyncPromise<void> : AsyncPromiseBase {
+    void return_void() {}
+
+    void result() {}
+};
+
+/**
+ * @brief A coroutine run by an AsyncLoop. It starts when it's awaited by another
+ *        task, which it inherits the loop from, or when it's spawned on a loop.
+ *        Exceptions are passed on to the awaiting task.
+ */
+template<typename T = void>
+class AsyncTask {
+public:
+    struct promise_type : AsyncPromise<T> {
+      AsyncTask get_return_object()
+      {
+	return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+    };
+
+    AsyncTask(AsyncTask&& other) noexcept : _handle{std::exchange(other._handle, nullptr)} {}
+    AsyncTask(const AsyncTask&) = delete;
+    AsyncTask& operator=(const AsyncTask&) = delete;
+
+    ~AsyncTask()
+    {
+      if (_handle) {
+	_handle.destroy();
+      }
+    }
+
+    struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return false; }
+
+      template<typename Promise>
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> caller) noexcept
+      {
+	handle.promise().loop = caller.promise().loop;
+	handle.promise().continuation = caller;
+	return handle;
+      }
+
+      T await_resume()
+      {
+	if (handle.promise().error) {
+	  std::rethrow_exception(handle.promise().error);
+	}
+	return handle.promise().result();
+      }
+    };
+
+    Awaiter operator co_await() const noexcept { return Awaiter{_handle}; }
+
+private:
+    friend class AsyncLoop;
+
+    explicit AsyncTask(std::coroutine_handle<promise_type> handle) : _handle{handle} {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+/**
+ * @brief Runs AsyncTasks on a single thread.
+ *
+ * Tasks suspend while they wait for replies or sleep, so any number of them can be
+ * in flight on the thread calling run(). Other threads, e.g. OSC server threads,
+ * only hand over tasks to resume; they never run them. Timeouts and cancellation
+ * are timers of the loop.
+ */
+class AsyncLoop {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @brief Something that happens at a point in time on the loop's thread.
+     */
+    class Timer {
+    public:
+      virtual void expire() = 0;
+
+    protected:
+      ~Timer() {}
+
+    private:
+      friend class AsyncLoop;
+      std::multimap<Clock::time_point, Timer*>::iterator _pos;
+      bool _armed = false;
+    };
+
+    /**
+     * @brief Awaitable that resumes the task at a point in time.
+     */
+    class Sleep : private Timer {
+    public:
+      explicit Sleep(Clock::time_point until) : _until{until} {}
+
+      bool await_ready() const { return _until <= Clock::now(); }
+
+      template<typename Promise>
+      void await_suspend(std::coroutine_handle<Promise> handle)
+      {
+	_handle = handle;
+	handle.promise().loop->add_timer(this, _until);
+      }
+
+      void await_resume() {}
+
+    private:
+      Clock::time_point _until;
+      std::coroutine_handle<> _handle;
+
+      void expire() override { _handle.resume(); }
+    };
+
+    AsyncLoop();
+    ~AsyncLoop();
+
+    /**
+     * @brief spawn Run a task on the loop. It starts once run() is called.
+     */
+    void spawn(AsyncTask<void> task);
+
+    /**
+     * @brief run Run the spawned tasks until all of them have finished. Only one
+     *        thread may run the loop at a time.
+     * @throws The first exception a spawned task didn't catch, after all of them
+     *         have finished.
+     */
+    void run();
+
+    /**
+     * @brief tasks Number of spawned tasks that haven't finished yet.
+     */
+    size_t tasks() const;
+
+    static Sleep sleep_until(Clock::time_point until) { return Sleep(until); }
+
+    template<typename Rep, typename Period>
+    static Sleep sleep_for(std::chrono::duration<Rep, Period> duration)
+    {
+      return Sleep(Clock::now() + std::chrono::duration_cast<Clock::duration>(duration));
+    }
+
+    /**
+     * @brief post Resume a suspended task on the loop's thread. Thread-safe.
+     * @param handle The task.
+     * @param cancel A timer of the task to remove if it hasn't expired yet, e.g. the
+     *        timeout of a reply that just arrived.
+     */
+    void post(std::coroutine_handle<> handle, Timer* cancel = nullptr);
+
+    /**
+     * @brief add_timer Have a timer expire at a point in time. Loop thread only.
+     */
+    void add_timer(Timer* timer, Clock::time_point at);
+
+    /**
+     * @brief expire_now Let a waiting timer expire right away, e.g. on cancellation.
+     *        Thread-safe.
+     */
+    void expire_now(Timer* timer);
+
+private:
+    friend struct AsyncPromiseBase;
+
+    mutable std::mutex _mtx;
+    std::condition_variable _cv;
+    std::deque<std::coroutine_handle<>> _ready;
+    std::multimap<Clock::time_point, Timer*> _timers;
+    size_t _tasks = 0;
+    std::exception_ptr _error;
+
+    void _finished(std::exception_ptr error);
+    void _disarm(Timer* timer);
+};
+
+/**
+ * @brief Awaitable that waits for the reply to a ReplyCorrelator request without
+ *        blocking the loop. Yields true if the reply arrived; false on timeout, on
+ *        cancellation via the stop token or if the reply is known to be lost.
+ */
+class AsyncReply : private AsyncLoop::Timer, private ReplyCorrelator::Waiter {
+public:
+    AsyncReply(ReplyCorrelator& correlator, const ReplyCorrelator::Ticket& ticket,
+	       ReplyCorrelator::Reply& reply, AsyncLoop::Clock::time_point deadline,
+	       std::stop_token stop = {}) :
+      _correlator{correlator}, _ticket{ticket}, _reply{reply}, _deadline{deadline},
+      _stop{std::move(stop)}
+    {
+    }
+
+    bool await_ready() const { return !_ticket.valid() || _stop.stop_requested(); }
+
+    template<typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> handle)
+    {
+      return _suspend(*handle.promise().loop, handle);
+    }
+
+    bool await_resume();
+
+private:
+    struct Cancel {
+      AsyncReply* self;
+      void operator()() noexcept { self->_loop->expire_now(self); }
+    };
+
+    ReplyCorrelator& _correlator;
+    ReplyCorrelator::Ticket _ticket;
+    ReplyCorrelator::Reply& _reply;
+    AsyncLoop::Clock::time_point _deadline;
+    std::stop_token _stop;
+    std::optional<std::stop_callback<Cancel>> _on_stop;
+    AsyncLoop* _loop = nullptr;
+    std::coroutine_handle<> _handle;
+
+    bool _suspend(AsyncLoop& loop, std::coroutine_handle<> handle);
+    void expire() override;   // Loop thread
+    void notify() override;   // OSC server thread
+};
+
+#endif // ASYNCLOOP_H
@@ -0,0 +1,183 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "goldentable.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(GoldenTable::Entry) == 20, "Entries are part of the file format");
+
+// Names longer than their header field are stored truncated, so they're compared
+// truncated as well. The file name tells tables of such names apart.
+template<size_t SIZE>
+static bool matches(const char (&field)[SIZE], const std::string& name)
+{
+  return std::string_view(field, strnlen(field, SIZE)) == std::string_view(name).substr(0, SIZE);
+}
+
+GoldenTable::GoldenTable(const std::string& path, const std::string& model, const std::string& firmware)
+{
+  _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (_fd < 0) {
+    throw std::system_error(errno, std::generic_category(), "Can't open " + path);
+  }
+
+  _size = sizeof(Header) + NUM_STEPS * sizeof(Entry);
+  struct stat st;
+  bool fresh = ::fstat(_fd, &st) != 0 || static_cast<size_t>(st.st_size) != _size;
+  if (fresh && ::ftruncate(_fd, _size) != 0) {
+    int err = errno;
+    ::close(_fd);
+    throw std::system_error(err, std::generic_category(), "Can't resize " + path);
+  }
+
+  _map = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (_map == MAP_FAILED) {
+    int err = errno;
+    ::close(_fd);
+    throw std::system_error(err, std::generic_category(), "Can't map " + path);
+  }
+  _header = static_cast<Header*>(_map);
+  _entries = reinterpret_cast<Entry*>(static_cast<char*>(_map) + sizeof(Header));
+
+  bool valid = !fresh
+    && std::memcmp(_header->magic, "XRGT", 4) == 0
+    && _header->version == VERSION
+    && _header->num_steps == NUM_STEPS
+    && _header->entry_size == sizeof(Entry)
+    && matches(_header->model, model)
+    && matches(_header->firmware, firmware);
+  if (!valid) {
+    _reset(model, firmware);
+  }
+}
+
+GoldenTable::~GoldenTable()
+{
+  if (_map) {
+    ::munmap(_map, _size);
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+}
+
+std::string GoldenTable::file_name(const std::string& model, const std::string& firmware)
+{
+  std::string name = "golden_" + model + "_" + firmware + ".bin";
+  std::replace_if(name.begin(), name.end(), [](char c) {
+      return !std::isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '_' && c != '-';
+    }, '_');
+
+  const char* home = std::getenv("HOME");
+  return std::string(home ? home : ".") + "/.xmairleveltest_" + name;
+}
+
+float GoldenTable::flevel(uint step)
+{
+  return step * 1.0f/(NUM_STEPS - 1);
+}
+
+uint GoldenTable::step(float flevel)
+{
+  if (!(flevel >= 0.0f && flevel <= 1.0f)) {
+    return NUM_STEPS;
+  }
+  uint step = static_cast<uint>(std::lround(flevel * (NUM_STEPS - 1)));
+  return GoldenTable::flevel(step) == flevel ? step : NUM_STEPS;
+}
+
+bool GoldenTable::has(uint step) const
+{
+  return step < NUM_STEPS && _entries[step].observed;
+}
+
+const GoldenTable::Entry& GoldenTable::entry(uint step) const
+{
+  return _entries[step];
+}
+
+bool GoldenTable::store(float flevel, float fader_float, std::string_view db)
+{
+  uint idx = step(flevel);
+  if (idx >= NUM_STEPS) {
+    return false;
+  }
+
+  Entry& entry = _entries[idx];
+  entry.flevel = flevel;
+  entry.fader_float = fader_float;
+  entry.db_len = static_cast<uint8_t>(std::min<size_t>(db.size(), DB_SIZE));
+  std::memcpy(entry.db, db.data(), entry.db_len);
+  entry.observed = 1;
+  return true;
+}
+
+std::vector<uint> GoldenTable::missing() const
+{
+  std::vector<uint> steps;
+  for (uint step = 0; step < NUM_STEPS; ++step) {
+    if (!_entries[step].observed) {
+      steps.push_back(step);
+    }
+  }
+  return steps;
+}
+
+uint GoldenTable::distinct_db() const
+{
+  // dB strings only change between neighbouring steps
+  uint count = 0;
+  std::string_view last;
+  for (uint step = 0; step < NUM_STEPS; ++step) {
+    if (_entries[step].observed && (count == 0 || _entries[step].db_string() != last)) {
+      last = _entries[step].db_string();
+      ++count;
+    }
+  }
+  return count;
+}
+
+void GoldenTable::sync()
+{
+  ::msync(_map, _size, MS_SYNC);
+}
+
+void GoldenTable::_reset(const std::string& model, const std::string& firmware)
+{
+  std::memset(_map, 0, _size);
+  std::memcpy(_header->magic, "XRGT", 4);
+  _header->version = VERSION;
+  _header->num_steps = NUM_STEPS;
+  _header->entry_size = sizeof(Entry);
+  std::memcpy(_header->model, model.data(), std::min(model.size(), sizeof(_header->model)));
+  std::memcpy(_header->firmware, firmware.data(), std::min(firmware.size(), sizeof(_header->firmware)));
+}
@@ -0,0 +1,144 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GOLDENTABLE_H
+#define GOLDENTABLE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Persistent table of a console's observed fader values, one entry per step of
+ *        an equidistant sweep of NUM_STEPS float levels.
+ *
+ * Entries are keyed by the float level that has been sent, not by what the console
+ * made of it, so the table can be checked against the console's rounding of levels
+ * between two indices, too.
+ *
+ * The table is a small binary file that is memory-mapped, so loading it is instant and
+ * stored entries are written back by the kernel. Each file belongs to one console
+ * model and firmware, see file_name(). A file written for another model, firmware or
+ * format version is reset when opened.
+ */
+class GoldenTable {
+public:
+    static const uint NUM_STEPS = 4096;
+    static const uint DB_SIZE = 10;
+
+    /**
+     * @brief What the console reported for a step's level.
+     */
+    struct Entry {
+      float flevel;           // Float level sent to the console
+      float fader_float;      // Float level reported by the console
+      uint8_t observed;       // 1 if the entry has been measured
+      uint8_t db_len;         // Length of db
+      char db[DB_SIZE];       // dB string reported via /node, not null terminated
+
+      std::string_view db_string() const { return std::string_view(db, db_len); }
+    };
+
+    /**
+     * @brief GoldenTable Open a table, creating it if necessary.
+     * @param path The table's file.
+     * @param model Console model, e.g. "XR18".
+     * @param firmware Console firmware, e.g. "1.15".
+     * @throws std::system_error if the file can't be created or mapped.
+     */
+    GoldenTable(const std::string& path, const std::string& model, const std::string& firmware);
+    ~GoldenTable();
+
+    GoldenTable(const GoldenTable&) = delete;
+    GoldenTable& operator=(const GoldenTable&) = delete;
+
+    /**
+     * @brief file_name Default file of a console's table, in $HOME.
+     */
+    static std::string file_name(const std::string& model, const std::string& firmware);
+
+    /**
+     * @brief flevel The float level sent for a step.
+     */
+    static float flevel(uint step);
+
+    /**
+     * @brief step The step a float level belongs to.
+     * @return NUM_STEPS if the level isn't one of the table's.
+     */
+    static uint step(float flevel);
+
+    /**
+     * @brief has Check wether a step has been measured.
+     */
+    bool has(uint step) const;
+
+    /**
+     * @brief entry The entry of a step.
+     */
+    const Entry& entry(uint step) const;
+
+    /**
+     * @brief store Store the console's values for a level sent.
+     * @param flevel Float level sent. Ignored unless it's a step's level.
+     * @param fader_float Float level reported by the console.
+     * @param db dB string reported via /node. Truncated to DB_SIZE.
+     * @return false if the level has been ignored.
+     */
+    bool store(float flevel, float fader_float, std::string_view db);
+
+    /**
+     * @brief missing Steps that haven't been measured yet.
+     */
+    std::vector<uint> missing() const;
+
+    /**
+     * @brief distinct_db Number of distinct dB strings over the measured steps.
+     */
+    uint distinct_db() const;
+
+    /**
+     * @brief sync Write changes to disk now instead of leaving it to the kernel.
+     */
+    void sync();
+
+private:
+    struct Header {
+      char magic[4];          // "XRGT"
+      uint32_t version;
+      uint32_t num_steps;
+      uint32_t entry_size;
+      char model[32];
+      char firmware[32];
+    };
+
+    static const uint32_t VERSION = 2;
+
+    int _fd = -1;
+    size_t _size = 0;
+    void* _map = nullptr;
+    Header* _header = nullptr;
+    Entry* _entries = nullptr;
+
+    void _reset(const std::string& model, const std::string& firmware);
+};
+
+#endif // GOLDENTABLE_H
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "latencyhistogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <sstream>
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration latency)
+{
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  uint64_t value = us > 0 ? static_cast<uint64_t>(us) : 0;
+
+  _buckets[_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+  _count.fetch_add(1, std::memory_order_relaxed);
+  _sum.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = _max.load(std::memory_order_relaxed);
+  while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+double LatencyHistogram::percentile(double p) const
+{
+  uint64_t count = _count.load(std::memory_order_relaxed);
+  if (count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * count + 0.5));
+  uint64_t seen = 0;
+  for (uint b = 0; b < NUM_BUCKETS; ++b) {
+    seen += _buckets[b].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      // The maximum is exact, so don't report more than that
+      return static_cast<double>(std::min(_upper_bound(b), _max.load(std::memory_order_relaxed)));
+    }
+  }
+
+  return static_cast<double>(_max.load(std::memory_order_relaxed));
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const
+{
+  uint64_t count = _count.load(std::memory_order_relaxed);
+  double mean = count > 0 ? static_cast<double>(_sum.load(std::memory_order_relaxed)) / count : 0;
+
+  return Summary{count, mean, percentile(0.5), percentile(0.9), percentile(0.99),
+		 static_cast<double>(_max.load(std::memory_order_relaxed))};
+}
+
+std::string LatencyHistogram::json() const
+{
+  auto s = summary();
+  std::ostringstream out;
+  out << "{\"count\": " << s.count << ", \"mean_us\": " << s.mean << ", \"p50_us\": " << s.p50
+      << ", \"p90_us\": " << s.p90 << ", \"p99_us\": " << s.p99 << ", \"max_us\": " << s.max << "}";
+
+  return out.str();
+}
+
+uint LatencyHistogram::_bucket(uint64_t us)
+{
+  if (us < SUB_BUCKETS) {
+    return static_cast<uint>(us);
+  }
+
+  // Values with their most significant bit at position msb fall into the
+  // magnitude msb - SUB_BUCKET_BITS + 1, the next bits select the sub-bucket.
+  uint msb = std::bit_width(us) - 1;
+  uint magnitude = msb - SUB_BUCKET_BITS + 1;
+  if (magnitude >= MAGNITUDES) {
+    return NUM_BUCKETS - 1;
+  }
+  uint sub = static_cast<uint>(us >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+  return magnitude * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::_upper_bound(uint bucket)
+{
+  uint magnitude = bucket / SUB_BUCKETS;
+  uint64_t sub = bucket % SUB_BUCKETS;
+  if (magnitude == 0) {
+    return sub;
+  }
+
+  uint64_t width = uint64_t(1) << (magnitude - 1);
+  return (SUB_BUCKETS + sub) * width + width - 1;
+}
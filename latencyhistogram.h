@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Lock-free latency histogram with microsecond resolution.
+ *
+ * Buckets are log-linear: each power of two is split into SUB_BUCKETS linear buckets,
+ * so percentiles are accurate to 1/SUB_BUCKETS of the value over the whole range
+ * from 1 us to about 70 minutes. Recording is a few relaxed atomic increments and
+ * can be done from any thread.
+ */
+class LatencyHistogram {
+public:
+    static const uint SUB_BUCKET_BITS = 3;
+    static const uint SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const uint MAGNITUDES = 32;
+    static const uint NUM_BUCKETS = MAGNITUDES * SUB_BUCKETS;
+
+    struct Summary {
+      uint64_t count;
+      double mean, p50, p90, p99, max;  // Microseconds
+    };
+
+    /**
+     * @brief record Add a latency sample.
+     */
+    void record(std::chrono::steady_clock::duration latency);
+
+    /**
+     * @brief percentile Latency below which the given share of samples lies.
+     * @param p Share of samples, e.g. 0.99.
+     * @return Upper bound of the matching bucket in microseconds, 0 without samples.
+     */
+    double percentile(double p) const;
+
+    /**
+     * @brief summary Count, mean, common percentiles and maximum.
+     */
+    Summary summary() const;
+
+    /**
+     * @brief json The summary as a JSON object.
+     */
+    std::string json() const;
+
+private:
+    std::atomic<uint64_t> _buckets[NUM_BUCKETS] = {};
+    std::atomic<uint64_t> _count{0}, _sum{0}, _max{0};
+
+    static uint _bucket(uint64_t us);
+    static uint64_t _upper_bound(uint bucket);
+};
+
+#endif // LATENCYHISTOGRAM_H
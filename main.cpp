@@ -18,40 +18,344 @@
  *
  */
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <memory>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 #include "xrm32level.hpp"
+#include "goldentable.h"
+#include "meterstream.h"
+#include "mixerdiscovery.h"
+#include "mixerstatemirror.h"
+#include "rampengine.h"
 #include "xmairleveltester.h"
 
 using namespace std::literals;
 const uint CHANNEL = 13;
+const uint WINDOW = 16; // Steps kept in flight during the sweep, 0 for serial testing
+const auto STATS_INTERVAL = 5s; // Statistics are written to xmairleveltest_stats*.json
+const std::string METER_BANK = "/meters/1"; // Input meters, the channels come first
+
+/**
+ * @brief check_fader Check a fader at each level of an equidistant sweep, one level
+ *        after another, on an AsyncLoop.
+ */
+static AsyncTask<void> check_fader(XMAirLevelTester& tester, const lo::Address& mixer, std::string path,
+				   uint num_steps, uint& mismatches)
+{
+  for (uint i = 0; i < num_steps; ++i) {
+    int err = co_await tester.check_level(mixer, path, i * 1.0f/(num_steps - 1));
+    if (err > 0) {
+      ++mismatches;
+    }
+  }
+}
+
+static void usage(const char* name)
+{
+  std::cout << "Usage: " << name << " [options] [HOST [PORT]]"
+	    << "\n  --discover         Search the network for mixers, ignoring the cache"
+	    << "\n  --sweep            Run the full hardware sweep"
+	    << "\n  --async            Check the faders as coroutines on a single thread"
+	    << "\n  --recvmmsg         Receive replies with OscReceiver instead of liblo"
+	    << "\n  --record FILE      Record all OSC traffic for xmairreplay"
+	    << "\n  --results FILE     Write every step to FILE, CSV or binary if it ends in .bin"
+	    << "\n  --meters           Stream the input meters of all mixers"
+	    << "\n  --mirror           Mirror the tested faders of the first mixer via /xremote"
+	    << "\n  --fade MS          Fade the tested faders down and up at the end"
+	    << std::endl;
+}
 
 int main(int argc, char* argv[])
 {
   std::cout << "Test the Xrm32Level implementation!" << std::endl;
 
-  // Search for mixer
-  XMAirLevelTester tester(CHANNEL);
-  std::unique_ptr<lo::Address> mixer{tester.find_mixer()};
+  // Mixers given on the command line, e.g. "./xmairleveltest 127.0.0.1" for a local
+  // xmairemulator, are used as they are. Otherwise the mixers found last time are
+  // asked first and the whole network is searched if none of them answers.
+  // "--discover" always searches the network.
+  //
+  // The console's replies to the sweep's levels are kept in a golden table per model
+  // and firmware, so only steps missing from it are measured and Xrm32Level is checked
+  // against the whole table. "--sweep" runs the full hardware sweep.
+  //
+  // "--record FILE" records all OSC traffic for replaying it with xmairreplay.
+  //
+  // "--recvmmsg" receives replies in batches with OscReceiver instead of liblo.
+  //
+  // "--async" checks every fader of every mixer as a coroutine on a single AsyncLoop
+  // thread instead of running a sweep thread per mixer. Each fader checks one level
+  // after another since checks of the same fader would overlap, so the number of
+  // checks in flight is the number of faders under test over all mixers.
+  //
+  // "--results FILE" writes every step to FILE instead of the console, as CSV or,
+  // if FILE ends in ".bin", in ResultSink's binary format.
+  //
+  // "--meters" streams the input meters of all mixers during the run.
+  //
+  // "--mirror" mirrors the tested faders of the first mixer via /xremote. The mixer
+  // then pushes each of the sweep's sets to a second client, which adds traffic to
+  // what the tester measures, so it's off by default.
+  //
+  // "--fade MS" finally fades the tested faders of all mixers from 0 dB down to -oo
+  // and back up, taking MS milliseconds each way, and reports the timing jitter.
+  bool discover = false, full_sweep = false, meters = false, mirror_faders = false, async = false;
+  uint fade_ms = 0;
+  auto receiver = XMAirLevelTester::LIBLO_RECEIVER;
+  std::string record_path, results_path;
+  std::vector<std::string> host_port;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--discover") {
+      discover = true;
+    } else if (arg == "--sweep") {
+      full_sweep = true;
+    } else if (arg == "--fade" && i + 1 < argc) {
+      fade_ms = std::stoul(argv[++i]);
+    } else if (arg == "--meters") {
+      meters = true;
+    } else if (arg == "--mirror") {
+      mirror_faders = true;
+    } else if (arg == "--async") {
+      async = true;
+    } else if (arg == "--recvmmsg") {
+      receiver = XMAirLevelTester::BATCH_RECEIVER;
+    } else if (arg == "--record" && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (arg == "--results" && i + 1 < argc) {
+      results_path = argv[++i];
+    } else if (arg.starts_with("-")) {
+      // Unknown or missing its value, don't take it for a host
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? 0 : -1;
+    } else {
+      host_port.push_back(arg);
+    }
+  }
+
+  MixerDiscovery discovery;
+  std::vector<MixerDiscovery::MixerInfo> infos;
+  if (!host_port.empty()) {
+    lo::Address addr(host_port[0], host_port.size() > 1 ? host_port[1] : "10024");
+    infos = discovery.probe({addr.url()});
+    if (infos.empty()) {
+      // Test it anyway, without knowing model and firmware
+      infos.push_back(MixerDiscovery::MixerInfo{addr.url()});
+    }
+  } else {
+    infos = discover ? discovery.discover() : discovery.find();
+    if (discover && !infos.empty()) {
+      discovery.save_cache(infos);
+    }
+  }
 
-  // mixer valid?
-  if (mixer == nullptr) {
+  // mixer found?
+  if (infos.empty()) {
     std::cout << "No mixer found!" << std::endl;
-    tester.stop();
     return -1;
   }
 
-  uint num_steps = 1024*4;
-  tester.run_tests(*(mixer.get()), num_steps, true);
+  for (const auto& info : infos) {
+    std::cout << "Found X Air device"
+	      << "\nName: " << info.name
+	      << "\nModel: " << info.model
+	      << "\nRev.: " << info.version
+	      << "\nFirmware: " << info.firmware
+	      << "\nURL: " << info.url
+	      << "\n" << std::endl;
+  }
+
+  // One tester per mixer. Each one has its own OSC server so their replies don't mix.
+  // Further faders, e.g. other channels, buses ("/bus/1/mix/fader") or DCAs
+  // ("/dca/1/fader"), can be added to test them concurrently in the same sweep.
+  std::vector<std::string> faders{XMAirLevelTester::channel_fader_path(CHANNEL)};
+  // The testers' batched messages refer to the mixers' addresses, so the mixers have
+  // to outlive them.
+  std::vector<std::unique_ptr<ResultSink>> sinks;
+  std::vector<std::unique_ptr<lo::Address>> mixers;
+  std::vector<std::unique_ptr<XMAirLevelTester>> testers;
+  std::vector<std::unique_ptr<GoldenTable>> tables;
+  for (const auto& info : infos) {
+    testers.emplace_back(new XMAirLevelTester(faders, receiver));
+    mixers.emplace_back(new lo::Address(info.url));
+    std::string suffix = testers.size() > 1 ? "_" + std::to_string(testers.size() - 1) : "";
+    testers.back()->export_stats("xmairleveltest_stats" + suffix + ".json", STATS_INTERVAL);
+    if (!record_path.empty()) {
+      testers.back()->start_capture(record_path + suffix);
+    }
+    if (!results_path.empty()) {
+      sinks.emplace_back(new ResultSink(results_path + suffix, ResultSink::format_for(results_path)));
+      testers.back()->set_result_sink(sinks.back().get());
+    }
+
+    tables.emplace_back();
+    if (!info.model.empty()) {
+      try {
+	tables.back().reset(new GoldenTable(GoldenTable::file_name(info.model, info.firmware),
+					    info.model, info.firmware));
+      } catch (const std::system_error& e) {
+	std::cout << "No golden table: " << e.what() << std::endl;
+      }
+    }
+  }
+
+  // Mirror the faders of the first mixer via /xremote. Being a separate client it
+  // gets the tester's changes pushed by the mixer.
+  std::atomic<uint64_t> pushed_changes{0};
+  std::unique_ptr<MixerStateMirror> mirror;
+  if (mirror_faders) {
+    mirror.reset(new MixerStateMirror(infos.front().url, faders));
+    mirror->on_change([&pushed_changes](const std::string&, const MixerStateMirror::Level&) {
+	++pushed_changes;
+      });
+    mirror->start();
+  }
+
+  std::vector<std::unique_ptr<MeterStream>> meter_streams;
+  if (meters) {
+    for (const auto& info : infos) {
+      meter_streams.emplace_back(new MeterStream(info.url, {METER_BANK}));
+      meter_streams.back()->start();
+    }
+  }
+
+  uint num_steps = GoldenTable::NUM_STEPS;
+  if (async) {
+    AsyncLoop loop;
+    std::vector<std::vector<uint>> mismatches(mixers.size(), std::vector<uint>(faders.size(), 0));
+    for (size_t m = 0; m < mixers.size(); ++m) {
+      for (size_t f = 0; f < faders.size(); ++f) {
+	loop.spawn(check_fader(*testers[m], *mixers[m], faders[f], num_steps, mismatches[m][f]));
+      }
+    }
+    auto start = std::chrono::steady_clock::now();
+    loop.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    for (size_t m = 0; m < mixers.size(); ++m) {
+      for (size_t f = 0; f < faders.size(); ++f) {
+	std::cout << "Async check of " << faders[f] << " on mixer at " << mixers[m]->url() << ": "
+		  << mismatches[m][f] << " of " << num_steps << " levels mismatched." << std::endl;
+      }
+    }
+    std::cout << "Checked " << mixers.size() * faders.size() * num_steps << " levels in "
+	      << elapsed.count() << " s on one thread." << std::endl;
+  } else if (WINDOW > 0) {
+    // Sweep all mixers in parallel, report one after another
+    std::vector<std::vector<std::vector<XMAirLevelTester::StepResult>>> results(mixers.size());
+    std::vector<std::thread> sweeps;
+    for (size_t m = 0; m < mixers.size(); ++m) {
+      std::vector<float> flevels;
+      if (full_sweep || !tables[m]) {
+	for (uint i = 0; i < num_steps; ++i) {
+	  flevels.push_back(i * 1.0f/(num_steps - 1));
+	}
+      } else {
+	for (uint step : tables[m]->missing()) {
+	  flevels.push_back(GoldenTable::flevel(step));
+	}
+      }
+      sweeps.emplace_back([&, m, flevels]() {
+	  if (!flevels.empty()) {
+	    results[m] = testers[m]->sweep(*mixers[m], flevels, WINDOW);
+	  }
+	});
+    }
+    for (size_t m = 0; m < mixers.size(); ++m) {
+      sweeps[m].join();
+      std::cout << "Results of mixer at " << mixers[m]->url() << ":" << std::endl;
+      if (tables[m] && !results[m].empty()) {
+	uint stored = XMAirLevelTester::record_golden(results[m].front(), *tables[m]);
+	tables[m]->sync();
+	std::cout << "Stored " << stored << " measurements in " << GoldenTable::file_name(infos[m].model,
+											    infos[m].firmware)
+		  << std::endl;
+      }
+      if (full_sweep || !tables[m]) {
+	testers[m]->report(results[m], true);
+      } else {
+	testers[m]->verify_golden(*tables[m], true);
+      }
+    }
+  } else {
+    for (size_t m = 0; m < mixers.size(); ++m) {
+      testers[m]->run_tests(*mixers[m], num_steps, true, WINDOW);
+    }
+  }
+
+  for (size_t m = 0; m < sinks.size(); ++m) {
+    testers[m]->set_result_sink(nullptr);
+    sinks[m]->close();
+    std::cout << "Wrote " << sinks[m]->records() << " results for mixer at " << mixers[m]->url()
+	      << std::endl;
+  }
+
+  if (fade_ms > 0) {
+    RampEngine::Level unity;
+    unity.setDb(0);
+    std::vector<std::unique_ptr<RampEngine>> engines;
+    for (const auto& info : infos) {
+      engines.emplace_back(new RampEngine(info.url));
+      engines.back()->start();
+    }
+    for (uint from : {unity.getIndex(), 0u}) {
+      uint to = from == 0 ? unity.getIndex() : 0;
+      for (auto& engine : engines) {
+	for (const auto& fader : faders) {
+	  engine->fade(fader, from, to, std::chrono::milliseconds(fade_ms));
+	}
+      }
+      for (auto& engine : engines) {
+	engine->wait();
+      }
+    }
+    for (size_t m = 0; m < engines.size(); ++m) {
+      engines[m]->stop();
+      auto stats = engines[m]->stats();
+      std::cout << "Fades on mixer at " << mixers[m]->url() << ": " << stats.messages
+		<< " updates in " << stats.packets << " datagrams over " << stats.ticks
+		<< " ticks, " << stats.missed << " missed. Jitter: p50 " << stats.jitter.p50
+		<< " us, p99 " << stats.jitter.p99 << " us, max " << stats.jitter.max << " us."
+		<< std::endl;
+    }
+  }
+
+  for (size_t m = 0; m < meter_streams.size(); ++m) {
+    meter_streams[m]->stop();
+    auto stats = meter_streams[m]->stats();
+    float dbs[CHANNEL];
+    size_t count = meter_streams[m]->bank(0).getDbs(dbs, CHANNEL);
+    std::cout << "Meters of mixer at " << mixers[m]->url() << ": " << stats.blobs << " blobs, "
+	      << stats.malformed << " malformed, " << stats.dropped << " dropped";
+    if (count == CHANNEL) {
+      std::cout << ", channel " << CHANNEL << " last at " << dbs[CHANNEL - 1] << " dB";
+    }
+    std::cout << "." << std::endl;
+  }
+
+  if (mirror) {
+    mirror->stop();
+    std::cout << "State mirror: " << pushed_changes << " fader changes pushed by the mixer, "
+	      << faders.front() << " at " << mirror->level(faders.front()).getOscStringView()
+	      << " dB." << std::endl;
+  }
 
   std::cout << "\nThe expected result currently is that we get two dB mismatches for index 765 and 769 respectively."
   	    << "\nThe desktop apps seem to give the same dB values for those levels.\n" << std::endl;
 
-  // Count distinct dB Strings.
-  tester.count_node_db(*(mixer.get()));
+  // Count distinct dB Strings, from the golden table if it's complete.
+  for (size_t m = 0; m < mixers.size(); ++m) {
+    if (tables[m] && tables[m]->missing().empty()) {
+      std::cout << "Counted " << tables[m]->distinct_db() << " distinct dB values in the golden table."
+		<< std::endl;
+    } else {
+      testers[m]->count_node_db(*mixers[m], WINDOW);
+    }
+  }
   std::cout << "\nExpected number of distinct values is 658.\n" << std::endl;
 
   // Check Patrick-Gilles Maillot's rounding formula
@@ -0,0 +1,139 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "meterstream.h"
+
+#include <stdexcept>
+
+#include "oscbatcher.h"
+
+MeterStream::MeterStream(const std::string& mixer_url, const std::vector<std::string>& banks,
+			 size_t capacity) :
+  _mixer_addr{mixer_url},
+  _lo_server{nullptr}
+{
+  for (const auto& path : banks) {
+    _banks.emplace_back(new Bank(path, capacity));
+  }
+
+  if (_lo_server.is_valid()) {
+    // The subscriptions are sent from the server, so the meters arrive at its socket.
+    _receiver.reset(new OscReceiver(_lo_server.socket_fd()));
+    for (size_t i = 0; i < _banks.size(); ++i) {
+      _receiver->add_method(_banks[i]->path, "b", [this, i](const OscReceiver::Message& msg) {
+	  std::string_view blob = msg.b(0);
+	  this->dispatch(i, blob.data(), blob.size());
+	});
+    }
+  }
+}
+
+MeterStream::~MeterStream()
+{
+  stop();
+}
+
+void MeterStream::start(std::chrono::milliseconds renew_interval)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx_renew);
+    if (_running) {
+      return;
+    }
+    _running = true;
+  }
+  if (_receiver) {
+    _receiver->start();
+  }
+  _subscribe();
+
+  _renewer = std::thread(&MeterStream::_renew_loop, this, renew_interval);
+}
+
+void MeterStream::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx_renew);
+    if (!_running) {
+      return;
+    }
+    _running = false;
+  }
+  _cv_renew.notify_all();
+  _renewer.join();
+  if (_receiver) {
+    _receiver->stop();
+  }
+}
+
+size_t MeterStream::banks() const
+{
+  return _banks.size();
+}
+
+const Xrm32::MeterBuffer& MeterStream::bank(size_t i) const
+{
+  return _banks.at(i)->buffer;
+}
+
+const Xrm32::MeterBuffer& MeterStream::bank(const std::string& path) const
+{
+  for (const auto& bank : _banks) {
+    if (bank->path == path) {
+      return bank->buffer;
+    }
+  }
+  throw std::out_of_range("No meter bank " + path);
+}
+
+void MeterStream::dispatch(size_t bank, const void* blob, size_t size)
+{
+  ++_blobs;
+  if (!_banks.at(bank)->buffer.publish(blob, size)) {
+    ++_malformed;
+  }
+}
+
+MeterStream::Stats MeterStream::stats() const
+{
+  return Stats{_blobs, _malformed, _receiver ? _receiver->stats().dropped : 0};
+}
+
+void MeterStream::_subscribe()
+{
+  // All banks in as few bundles as the console takes
+  OscBatcher::Config config;
+  config.max_delay = std::chrono::microseconds(0);
+  OscBatcher batcher(_lo_server, config);
+  for (const auto& bank : _banks) {
+    lo::Message msg;
+    msg.add_string(bank->path);
+    batcher.add(_mixer_addr, "/meters", msg);
+  }
+  batcher.flush();
+}
+
+void MeterStream::_renew_loop(std::chrono::milliseconds renew_interval)
+{
+  std::unique_lock<std::mutex> lock(_mtx_renew);
+  while (!_cv_renew.wait_for(lock, renew_interval, [this]() { return !_running; })) {
+    _subscribe();
+  }
+}
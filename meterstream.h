@@ -0,0 +1,123 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef METERSTREAM_H
+#define METERSTREAM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lo/lo_cpp.h>
+
+#include "oscreceiver.h"
+#include "xrm32meter.hpp"
+
+/**
+ * @brief The meter banks of a mixer, e.g. "/meters/1" with all input channels.
+ *
+ * The stream subscribes to each bank with /meters and renews the subscriptions in the
+ * background before the mixer stops sending. The blobs arrive every 50 ms per bank, so
+ * they're received with OscReceiver, many datagrams per system call, and each is
+ * decoded in one go in the receive buffer and published to the bank's
+ * Xrm32::MeterBuffer, from where any thread reads the latest values without locking.
+ */
+class MeterStream {
+public:
+    struct Stats {
+      uint64_t blobs;       // Meter blobs received
+      uint64_t malformed;   // Blobs shorter than their count says
+      uint64_t dropped;     // Datagrams dropped by the kernel, if it reports them
+    };
+
+    /**
+     * @brief MeterStream
+     * @param mixer_url URL of the mixer, e.g. "osc.udp://192.168.1.20:10024/".
+     * @param banks Meter banks to subscribe to, e.g. "/meters/1".
+     * @param capacity Maximum number of values per bank.
+     */
+    MeterStream(const std::string& mixer_url, const std::vector<std::string>& banks,
+		size_t capacity = 128);
+    ~MeterStream();
+
+    /**
+     * @brief start Subscribe to all banks.
+     * @param renew_interval Time between renewals. The mixer stops sending a bank
+     *        10 seconds after the last /meters for it.
+     */
+    void start(std::chrono::milliseconds renew_interval = std::chrono::seconds(9));
+
+    /**
+     * @brief stop Stop renewing the subscriptions and receiving meters.
+     */
+    void stop();
+
+    /**
+     * @brief banks Number of banks, in the order given to the constructor.
+     */
+    size_t banks() const;
+
+    /**
+     * @brief bank Latest values of a bank.
+     * @throws std::out_of_range if there's no such bank.
+     */
+    const Xrm32::MeterBuffer& bank(size_t i) const;
+    const Xrm32::MeterBuffer& bank(const std::string& path) const;
+
+    /**
+     * @brief dispatch Publish a meter blob as if it had been received, e.g. from a
+     *        recording or another receiver. Mustn't be called while receiving.
+     */
+    void dispatch(size_t bank, const void* blob, size_t size);
+
+    /**
+     * @brief stats Counters since construction.
+     */
+    Stats stats() const;
+
+private:
+    struct Bank {
+      std::string path;
+      Xrm32::MeterBuffer buffer;
+
+      Bank(const std::string& path, size_t capacity) : path{path}, buffer{capacity} {}
+    };
+
+    lo::Address _mixer_addr;
+    lo::ServerThread _lo_server;              // Only sends, never started
+    std::unique_ptr<OscReceiver> _receiver;   // Reads _lo_server's socket
+    std::vector<std::unique_ptr<Bank>> _banks;
+    std::atomic<uint64_t> _blobs{0}, _malformed{0};
+
+    std::thread _renewer;
+    bool _running = false;
+    std::mutex _mtx_renew;
+    std::condition_variable _cv_renew;
+
+    void _subscribe();
+    void _renew_loop(std::chrono::milliseconds renew_interval);
+};
+
+#endif // METERSTREAM_H
@@ -0,0 +1,178 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "mixerdiscovery.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+const int XMAIR_PORT = 10024;
+
+MixerDiscovery::MixerDiscovery(const std::string& cache_file) :
+  _cache_file{cache_file},
+  _lo_server{nullptr},
+  _broadcast_addr{"255.255.255.255", XMAIR_PORT}
+{
+  if (_cache_file.empty()) {
+    const char* home = std::getenv("HOME");
+    _cache_file = std::string(home ? home : ".") + "/.xmairleveltest_mixers";
+  }
+
+  if (_lo_server.is_valid()) {
+    _lo_server.add_method("/info", "ssss",
+			  [this](const char* path, const lo::Message &msg) {
+			    return this->_info_handler(path, msg);
+			  });
+    _lo_server.start();
+  }
+}
+
+MixerDiscovery::~MixerDiscovery()
+{
+  _lo_server.stop();
+}
+
+std::vector<MixerDiscovery::MixerInfo> MixerDiscovery::discover(Clock::duration quiet,
+								 Clock::duration timeout)
+{
+  std::unique_lock<std::mutex> lock(_mtx_found);
+  _found.clear();
+  auto start = Clock::now();
+  _broadcast_addr.send_from(_lo_server, "/info", "N", nullptr);
+
+  // Mixers answer within a few milliseconds, so once the replies stop
+  // coming in for a while there won't be any more.
+  for (;;) {
+    auto until = _found.empty() ? start + timeout : _last_found + quiet;
+    if (Clock::now() >= until) {
+      break;
+    }
+    _cv_found.wait_until(lock, until);
+  }
+
+  return _found;
+}
+
+std::vector<MixerDiscovery::MixerInfo> MixerDiscovery::probe(const std::vector<std::string>& urls,
+							      Clock::duration timeout)
+{
+  std::unique_lock<std::mutex> lock(_mtx_found);
+  _found.clear();
+  for (const auto& url : urls) {
+    lo::Address addr(url);
+    addr.send_from(_lo_server, "/info", "N", nullptr);
+  }
+
+  _cv_found.wait_until(lock, Clock::now() + timeout,
+		       [this, &urls]() { return _found.size() >= urls.size(); });
+
+  return _found;
+}
+
+std::vector<MixerDiscovery::MixerInfo> MixerDiscovery::find()
+{
+  std::vector<MixerInfo> mixers;
+  auto cached = load_cache();
+  if (!cached.empty()) {
+    std::vector<std::string> urls;
+    for (const auto& mixer : cached) {
+      urls.push_back(mixer.url);
+    }
+    mixers = probe(urls);
+  }
+  if (mixers.empty()) {
+    mixers = discover();
+  }
+
+  // A cached mixer that didn't answer may just be switched off for the moment, so it's
+  // kept for the next start. The others are updated with their answers.
+  auto known = mixers;
+  for (const auto& mixer : cached) {
+    bool found = false;
+    for (const auto& answered : mixers) {
+      found = found || answered.url == mixer.url;
+    }
+    if (!found) {
+      known.push_back(mixer);
+    }
+  }
+  if (!known.empty()) {
+    save_cache(known);
+  }
+
+  return mixers;
+}
+
+std::vector<MixerDiscovery::MixerInfo> MixerDiscovery::load_cache() const
+{
+  // One mixer per line: url, name, model, version and firmware separated by tabs
+  std::vector<MixerInfo> mixers;
+  std::ifstream cache(_cache_file);
+  std::string line;
+  while (std::getline(cache, line)) {
+    std::istringstream fields(line);
+    MixerInfo mixer;
+    std::getline(fields, mixer.url, '\t');
+    std::getline(fields, mixer.name, '\t');
+    std::getline(fields, mixer.model, '\t');
+    std::getline(fields, mixer.version, '\t');
+    std::getline(fields, mixer.firmware, '\t');
+    if (!mixer.url.empty()) {
+      mixers.push_back(std::move(mixer));
+    }
+  }
+
+  return mixers;
+}
+
+bool MixerDiscovery::save_cache(const std::vector<MixerInfo>& mixers) const
+{
+  std::ofstream cache(_cache_file, std::ios::trunc);
+  for (const auto& mixer : mixers) {
+    cache << mixer.url << '\t' << mixer.name << '\t' << mixer.model << '\t'
+	  << mixer.version << '\t' << mixer.firmware << '\n';
+  }
+
+  return static_cast<bool>(cache);
+}
+
+std::string MixerDiscovery::cache_file() const
+{
+  return _cache_file;
+}
+
+int MixerDiscovery::_info_handler(const char* path, const lo::Message &msg)
+{
+  MixerInfo mixer{msg.source().url(), &msg.argv()[1]->s, &msg.argv()[2]->s,
+		  &msg.argv()[0]->s, &msg.argv()[3]->s};
+
+  std::lock_guard<std::mutex> lock(_mtx_found);
+  for (const auto& found : _found) {
+    if (found.url == mixer.url) {
+      return 0; // e.g. reached via more than one interface
+    }
+  }
+  _found.push_back(std::move(mixer));
+  _last_found = Clock::now();
+  _cv_found.notify_all();
+
+  return 0;
+}
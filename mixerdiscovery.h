@@ -0,0 +1,116 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MIXERDISCOVERY_H
+#define MIXERDISCOVERY_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <lo/lo_cpp.h>
+
+/**
+ * @brief Finds all X Air / X32 mixers on the network by their replies to /info.
+ *        Known mixers are cached in a file so that a restart only has to ask them
+ *        directly instead of waiting for a broadcast to settle.
+ */
+class MixerDiscovery {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @brief A mixer as reported by its /info reply.
+     */
+    struct MixerInfo {
+      std::string url;        // e.g. "osc.udp://192.168.1.20:10024/"
+      std::string name;       // e.g. "XR18-12-34-56"
+      std::string model;      // e.g. "XR18"
+      std::string version;    // Protocol revision
+      std::string firmware;   // e.g. "1.15"
+    };
+
+    /**
+     * @brief MixerDiscovery
+     * @param cache_file File to load and save known mixers. Empty for the default,
+     *        $HOME/.xmairleveltest_mixers.
+     */
+    explicit MixerDiscovery(const std::string& cache_file = "");
+    ~MixerDiscovery();
+
+    /**
+     * @brief discover Broadcast /info and collect every mixer that answers.
+     * @param quiet Return once no new mixer has answered for this long.
+     * @param timeout Give up if nobody answers within this time.
+     * @return All mixers found, in the order they answered.
+     */
+    std::vector<MixerInfo> discover(Clock::duration quiet = std::chrono::milliseconds(250),
+				    Clock::duration timeout = std::chrono::seconds(1));
+
+    /**
+     * @brief probe Ask mixers at known URLs directly via /info.
+     * @param urls The URLs to ask.
+     * @param timeout Give up on mixers that haven't answered within this time.
+     * @return The mixers that answered. Returns as soon as all of them did.
+     */
+    std::vector<MixerInfo> probe(const std::vector<std::string>& urls,
+				 Clock::duration timeout = std::chrono::milliseconds(250));
+
+    /**
+     * @brief find Probe the cached mixers and fall back to discover() if none of
+     *        them answers. Merges the answers into the cache, cached mixers that
+     *        didn't answer are kept.
+     * @return All mixers found.
+     */
+    std::vector<MixerInfo> find();
+
+    /**
+     * @brief load_cache The mixers known from earlier runs, as they answered then.
+     */
+    std::vector<MixerInfo> load_cache() const;
+
+    /**
+     * @brief save_cache Remember mixers for the next start.
+     * @return false if the cache file couldn't be written.
+     */
+    bool save_cache(const std::vector<MixerInfo>& mixers) const;
+
+    /**
+     * @brief cache_file The file used for caching.
+     */
+    std::string cache_file() const;
+
+private:
+    std::string _cache_file;
+    lo::ServerThread _lo_server;
+    lo::Address _broadcast_addr;
+
+    // Replies of the current discover() or probe(), filled by the server thread
+    std::vector<MixerInfo> _found;
+    Clock::time_point _last_found;
+    std::mutex _mtx_found;
+    std::condition_variable _cv_found;
+
+    int _info_handler(const char* path, const lo::Message& msg);
+};
+
+#endif // MIXERDISCOVERY_H
@@ -0,0 +1,137 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "mixerstatemirror.h"
+
+#include "oscbatcher.h"
+
+MixerStateMirror::MixerStateMirror(const std::string& mixer_url,
+				   const std::vector<std::string>& fader_paths) :
+  _mixer_addr{mixer_url},
+  _lo_server{nullptr}
+{
+  for (const auto& path : fader_paths) {
+    _faders.emplace(path, std::unique_ptr<Fader>(new Fader));
+  }
+
+  if (_lo_server.is_valid()) {
+    // Pushed changes and replies to our queries look the same
+    for (const auto& fader : _faders) {
+      const std::string& path = fader.first;
+      _lo_server.add_method(path.c_str(), "f",
+			    [this, path](const char*, const lo::Message &msg) {
+			      return this->_fader_handler(path, msg);
+			    });
+    }
+  }
+}
+
+MixerStateMirror::~MixerStateMirror()
+{
+  stop();
+}
+
+void MixerStateMirror::on_change(ChangeHandler handler)
+{
+  _change_handler = std::move(handler);
+}
+
+void MixerStateMirror::start(std::chrono::milliseconds renew_interval)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx_renew);
+    if (_running) {
+      return;
+    }
+    _running = true;
+  }
+  _lo_server.start();
+
+  // Subscribe before querying so no change in between gets lost. The queries of
+  // all faders go out in as few bundles as the console takes.
+  OscBatcher::Config config;
+  config.max_delay = std::chrono::microseconds(0);
+  OscBatcher batcher(_lo_server, config);
+  batcher.add(_mixer_addr, "/xremote", lo::Message());
+  for (const auto& fader : _faders) {
+    batcher.add(_mixer_addr, fader.first, lo::Message());
+  }
+  batcher.flush();
+
+  _renewer = std::thread(&MixerStateMirror::_renew_loop, this, renew_interval);
+}
+
+void MixerStateMirror::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx_renew);
+    if (!_running) {
+      return;
+    }
+    _running = false;
+  }
+  _cv_renew.notify_all();
+  _renewer.join();
+  _lo_server.stop();
+}
+
+bool MixerStateMirror::has(const std::string& path) const
+{
+  return _faders.count(path) > 0;
+}
+
+const MixerStateMirror::Level& MixerStateMirror::level(const std::string& path) const
+{
+  return _faders.at(path)->level;
+}
+
+bool MixerStateMirror::synced(const std::string& path) const
+{
+  return _faders.at(path)->synced;
+}
+
+uint64_t MixerStateMirror::updates() const
+{
+  return _updates;
+}
+
+int MixerStateMirror::_fader_handler(const std::string& path, const lo::Message &msg)
+{
+  Fader& fader = *_faders.at(path);
+  uint old_index = fader.level.getIndex();
+  fader.level.setFloat(msg.argv()[0]->f);
+  bool changed = !fader.synced || fader.level.getIndex() != old_index;
+  fader.synced = true;
+  ++_updates;
+
+  if (changed && _change_handler) {
+    _change_handler(path, fader.level);
+  }
+
+  return 0;
+}
+
+void MixerStateMirror::_renew_loop(std::chrono::milliseconds renew_interval)
+{
+  std::unique_lock<std::mutex> lock(_mtx_renew);
+  while (!_cv_renew.wait_for(lock, renew_interval, [this]() { return !_running; })) {
+    _mixer_addr.send_from(_lo_server, "/xremote", "", nullptr);
+  }
+}
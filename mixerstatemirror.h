@@ -0,0 +1,130 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MIXERSTATEMIRROR_H
+#define MIXERSTATEMIRROR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lo/lo_cpp.h>
+
+#include "xrm32level.hpp"
+
+/**
+ * @brief Local copy of a mixer's fader levels, kept up to date by the mixer itself.
+ *
+ * The mirror subscribes to the mixer's change notifications with /xremote and renews
+ * the subscription in the background before it runs out. Each fader is queried once on
+ * start, afterwards every change pushed by the mixer updates the fader's Level. Reads
+ * are served from memory without any network round trip.
+ *
+ * The mixer doesn't push changes back to the client that made them, so faders set by
+ * the owner of the mirror's own connection won't show up. Use a separate client.
+ */
+class MixerStateMirror {
+public:
+    typedef Xrm32::Level<1024> Level;
+
+    /**
+     * @brief Called from the OSC server thread whenever a fader's level changes.
+     */
+    typedef std::function<void(const std::string& path, const Level& level)> ChangeHandler;
+
+    /**
+     * @brief MixerStateMirror
+     * @param mixer_url URL of the mixer, e.g. "osc.udp://192.168.1.20:10024/".
+     * @param fader_paths Faders to mirror, e.g. "/ch/01/mix/fader".
+     */
+    MixerStateMirror(const std::string& mixer_url, const std::vector<std::string>& fader_paths);
+    ~MixerStateMirror();
+
+    /**
+     * @brief on_change Set the change notification callback. Has to be set before start().
+     */
+    void on_change(ChangeHandler handler);
+
+    /**
+     * @brief start Subscribe to changes and query all faders once.
+     * @param renew_interval Time between subscription renewals. The mixer stops
+     *        pushing changes 10 seconds after the last /xremote.
+     */
+    void start(std::chrono::milliseconds renew_interval = std::chrono::seconds(9));
+
+    /**
+     * @brief stop Stop renewing the subscription and receiving changes.
+     */
+    void stop();
+
+    /**
+     * @brief has Check wether a fader is mirrored.
+     */
+    bool has(const std::string& path) const;
+
+    /**
+     * @brief level Current level of a fader. The reference stays valid as long as the
+     *        mirror exists and always reflects the latest level, it's safe to read it
+     *        while it's being updated.
+     * @throws std::out_of_range if the fader isn't mirrored.
+     */
+    const Level& level(const std::string& path) const;
+
+    /**
+     * @brief synced Check wether the mixer has reported the fader's level yet.
+     * @throws std::out_of_range if the fader isn't mirrored.
+     */
+    bool synced(const std::string& path) const;
+
+    /**
+     * @brief updates Number of updates received from the mixer.
+     */
+    uint64_t updates() const;
+
+private:
+    // Only written by the OSC server thread. Level's index is atomic.
+    struct Fader {
+      Level level;
+      std::atomic<bool> synced{false};
+    };
+
+    lo::Address _mixer_addr;
+    lo::ServerThread _lo_server;
+    std::map<std::string, std::unique_ptr<Fader>> _faders;
+    ChangeHandler _change_handler;
+    std::atomic<uint64_t> _updates{0};
+
+    std::thread _renewer;
+    bool _running = false;
+    std::mutex _mtx_renew;
+    std::condition_variable _cv_renew;
+
+    int _fader_handler(const std::string& path, const lo::Message& msg);
+    void _renew_loop(std::chrono::milliseconds renew_interval);
+};
+
+#endif // MIXERSTATEMIRROR_H
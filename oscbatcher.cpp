@@ -0,0 +1,139 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "oscbatcher.h"
+
+// "#bundle" and the time tag, each element is preceded by its size
+const size_t BUNDLE_HEADER_SIZE = 16;
+const size_t ELEMENT_HEADER_SIZE = 4;
+
+OscBatcher::OscBatcher(lo::Server& from, const Config& config) :
+  _from(from),
+  _config{config}
+{
+  if (_config.max_delay.count() > 0) {
+    _flusher = std::thread(&OscBatcher::_flush_loop, this);
+  }
+}
+
+OscBatcher::~OscBatcher()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _running = false;
+  }
+  _cv.notify_all();
+  if (_flusher.joinable()) {
+    _flusher.join();
+  }
+  flush();
+}
+
+uint64_t OscBatcher::add(const lo::Address& to, const std::string& path, const lo::Message& msg)
+{
+  size_t size = ELEMENT_HEADER_SIZE + msg.length(path);
+
+  std::unique_lock<std::mutex> lock(_mtx);
+  if (!_pending.empty() && (_to != &to || _pending.size() >= _config.max_messages
+			    || _size + size > _config.max_packet)) {
+    _flush();
+  }
+
+  if (_pending.empty()) {
+    _to = &to;
+    _size = BUNDLE_HEADER_SIZE;
+    _oldest = Clock::now();
+  }
+  _pending.push_back(Pending{path, msg});
+  _size += size;
+  uint64_t seq = _added++;
+
+  if (_pending.size() >= _config.max_messages || _size >= _config.max_packet) {
+    _flush();
+  } else if (_pending.size() == 1) {
+    lock.unlock();
+    _cv.notify_one(); // New deadline
+  }
+
+  return seq;
+}
+
+void OscBatcher::flush(uint64_t seq)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  if (seq >= _sent) {
+    _flush();
+  }
+}
+
+void OscBatcher::on_send(SendHandler handler)
+{
+  _on_send = std::move(handler);
+}
+
+OscBatcher::Stats OscBatcher::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  return Stats{_sent, _packets};
+}
+
+void OscBatcher::_flush()
+{
+  // Sent under the lock so datagrams leave in the order of their messages
+  if (_pending.empty()) {
+    return;
+  }
+
+  if (_on_send) {
+    for (const auto& pending : _pending) {
+      _on_send(pending.path, pending.msg);
+    }
+  }
+  if (_pending.size() == 1) {
+    _to->send_from(_from, _pending.front().path, _pending.front().msg);
+  } else {
+    lo::Bundle bundle;
+    for (const auto& pending : _pending) {
+      bundle.add(pending.path, pending.msg);
+    }
+    lo_send_bundle_from(*_to, _from, bundle);
+  }
+
+  _sent += _pending.size();
+  ++_packets;
+  _pending.clear();
+}
+
+void OscBatcher::_flush_loop()
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  while (_running) {
+    if (_pending.empty()) {
+      _cv.wait(lock);
+      continue;
+    }
+    auto deadline = _oldest + _config.max_delay;
+    if (Clock::now() < deadline) {
+      _cv.wait_until(lock, deadline);
+      continue;
+    }
+    _flush();
+  }
+}
@@ -0,0 +1,126 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OSCBATCHER_H
+#define OSCBATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <lo/lo_cpp.h>
+
+/**
+ * @brief Coalesces outgoing OSC messages into bundles.
+ *
+ * Messages to the same destination are collected and sent as one OSC bundle, in the
+ * order they have been added, once the bundle is full or the oldest message has waited
+ * for the configured delay. A bundle holding a single message is sent as a plain
+ * message. The mixer handles the elements of a bundle one after another, so replies
+ * keep the order of the requests.
+ */
+class OscBatcher {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Config {
+      size_t max_packet;                  // Largest bundle in bytes
+      uint max_messages;                  // Most messages per bundle, 1 disables bundling
+      std::chrono::microseconds max_delay;  // Longest a message waits, 0 for flush() only
+
+      // A bundle arrives at the console all at once, so it has to fit into its input
+      // queue as well as into a single unfragmented datagram.
+      Config() : max_packet{1024}, max_messages{16}, max_delay{1000} {}
+    };
+
+    typedef std::function<void(const std::string& path, const lo::Message& msg)> SendHandler;
+
+    struct Stats {
+      uint64_t messages;    // Messages sent
+      uint64_t packets;     // Datagrams sent, bundles or plain messages
+    };
+
+    /**
+     * @brief OscBatcher
+     * @param from The server to send from, so replies reach it.
+     * @param config Bundle limits.
+     */
+    explicit OscBatcher(lo::Server& from, const Config& config = Config());
+    ~OscBatcher();
+
+    /**
+     * @brief add Queue a message. Sends the pending bundle first if the message
+     *        doesn't fit or goes to another destination. Thread-safe.
+     * @param to The destination. Has to stay valid until the message has been sent,
+     *        flush() before destroying it.
+     * @return Sequence number of the message, see flush().
+     */
+    uint64_t add(const lo::Address& to, const std::string& path, const lo::Message& msg);
+
+    /**
+     * @brief flush Send the pending bundle right away, e.g. before waiting for a reply.
+     * @param seq Only flush if the message with this sequence number hasn't been
+     *        sent yet. Flushes unconditionally by default.
+     */
+    void flush(uint64_t seq = ~uint64_t(0));
+
+    /**
+     * @brief on_send Called with every message right before its datagram is sent,
+     *        e.g. for recording it with the time it actually leaves. Not thread-safe,
+     *        set it before adding messages.
+     */
+    void on_send(SendHandler handler);
+
+    /**
+     * @brief stats Counts of messages and datagrams sent.
+     */
+    Stats stats() const;
+
+private:
+    struct Pending {
+      std::string path;
+      lo::Message msg;
+    };
+
+    lo::Server& _from;
+    Config _config;
+    mutable std::mutex _mtx;
+    std::condition_variable _cv;
+    const lo::Address* _to = nullptr;
+    std::vector<Pending> _pending;
+    size_t _size = 0;                 // Bundle size of the pending messages
+    Clock::time_point _oldest;        // When the first pending message was added
+    uint64_t _added = 0, _sent = 0;   // Sequence numbers
+    uint64_t _packets = 0;
+    bool _running = true;
+    std::thread _flusher;
+    SendHandler _on_send;
+
+    void _flush();
+    void _flush_loop();
+};
+
+#endif // OSCBATCHER_H
@@ -0,0 +1,346 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "oscreceiver.h"
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+const uint MAX_BUNDLE_DEPTH = 8;  // Nested bundles
+const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(uint32_t));  // SO_RXQ_OVFL drop counter
+
+// Length of a padded OSC string starting at data, 0 if it isn't terminated
+static size_t padded_length(const char* data, size_t size)
+{
+  const void* end = std::memchr(data, '\0', size);
+  if (!end) {
+    return 0;
+  }
+  size_t length = (static_cast<const char*>(end) - data + 4) & ~size_t(3);
+  return length <= size ? length : 0;
+}
+
+bool OscReceiver::Message::parse(const char* data, size_t size)
+{
+  _data = data;
+  _size = size;
+  _argc = 0;
+
+  // Paths needn't start with '/', X Air consoles answer /node on path "node".
+  size_t path_length = padded_length(data, size);
+  if (path_length == 0 || data[0] == '#') {
+    return false;
+  }
+  _path = std::string_view(data);
+
+  size_t pos = path_length;
+  if (pos == size) {
+    _types = std::string_view(); // Old style message without type tags
+    return true;
+  }
+  size_t types_length = padded_length(data + pos, size - pos);
+  if (types_length == 0 || data[pos] != ',') {
+    return false;
+  }
+  _types = std::string_view(data + pos + 1);
+  pos += types_length;
+
+  for (char type : _types) {
+    if (_argc < MAX_ARGS) {
+      _offsets[_argc] = pos;
+    }
+    size_t length;
+    switch (type) {
+    case 'i': case 'f': case 'c': case 'r': case 'm':
+      length = 4;
+      break;
+    case 'h': case 'd': case 't':
+      length = 8;
+      break;
+    case 's': case 'S':
+      length = pos < size ? padded_length(data + pos, size - pos) : 0;
+      if (length == 0) {
+	return false;
+      }
+      break;
+    case 'b': {
+      if (pos + 4 > size) {
+	return false;
+      }
+      uint32_t blob_size;
+      std::memcpy(&blob_size, data + pos, 4);
+      length = 4 + ((uint64_t(ntohl(blob_size)) + 3) & ~uint64_t(3));
+      break;
+    }
+    case 'T': case 'F': case 'N': case 'I':
+      length = 0;
+      break;
+    default:
+      return false;
+    }
+    if (pos + length > size) {
+      return false;
+    }
+    pos += length;
+    if (_argc < MAX_ARGS) {
+      ++_argc;
+    }
+  }
+
+  return true;
+}
+
+uint32_t OscReceiver::Message::_u32(uint n) const
+{
+  uint32_t value;
+  std::memcpy(&value, _data + _offsets[n], sizeof(value));
+  return ntohl(value);
+}
+
+uint64_t OscReceiver::Message::_u64(uint n) const
+{
+  uint64_t value;
+  std::memcpy(&value, _data + _offsets[n], sizeof(value));
+  return be64toh(value);
+}
+
+int32_t OscReceiver::Message::i(uint n) const
+{
+  return static_cast<int32_t>(_u32(n));
+}
+
+float OscReceiver::Message::f(uint n) const
+{
+  uint32_t bits = _u32(n);
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+int64_t OscReceiver::Message::h(uint n) const
+{
+  return static_cast<int64_t>(_u64(n));
+}
+
+double OscReceiver::Message::d(uint n) const
+{
+  uint64_t bits = _u64(n);
+  double value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+std::string_view OscReceiver::Message::s(uint n) const
+{
+  return std::string_view(_data + _offsets[n]);
+}
+
+std::string_view OscReceiver::Message::b(uint n) const
+{
+  return std::string_view(_data + _offsets[n] + 4, _u32(n));
+}
+
+OscReceiver::OscReceiver(int fd, const Config& config) :
+  _fd{fd},
+  _wakeup{::eventfd(0, EFD_NONBLOCK)},
+  _config{config},
+  _buffers(config.batch * config.max_datagram),
+  _sources(config.batch)
+{
+  if (_wakeup < 0) {
+    throw std::system_error(errno, std::generic_category(), "Can't create eventfd");
+  }
+
+  // A larger socket buffer absorbs bursts while handlers run. The kernel's drop
+  // counter is reported with each datagram where supported.
+  if (_config.socket_buffer > 0) {
+    ::setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &_config.socket_buffer, sizeof(_config.socket_buffer));
+  }
+  int on = 1;
+  ::setsockopt(_fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+}
+
+OscReceiver::~OscReceiver()
+{
+  stop();
+  ::close(_wakeup);
+}
+
+void OscReceiver::add_method(const std::string& path, const std::string& types, Handler handler)
+{
+  _methods[path] = Method{types, std::move(handler)};
+}
+
+void OscReceiver::on_message(Handler handler)
+{
+  _on_message = std::move(handler);
+}
+
+void OscReceiver::start()
+{
+  if (_running.exchange(true)) {
+    return;
+  }
+  _thread = std::thread(&OscReceiver::_receive_loop, this);
+}
+
+void OscReceiver::stop()
+{
+  if (!_running.exchange(false)) {
+    return;
+  }
+  uint64_t one = 1;
+  if (::write(_wakeup, &one, sizeof(one)) < 0) {
+    // Can't happen unless the counter overflows; the thread exits anyway.
+  }
+  _thread.join();
+}
+
+int OscReceiver::dispatch(const char* data, size_t size, const sockaddr_storage* source)
+{
+  ++_datagrams;
+  int messages = _dispatch(data, size, source, 0);
+  if (messages < 0) {
+    ++_malformed;
+  }
+  return messages;
+}
+
+OscReceiver::Stats OscReceiver::stats() const
+{
+  return Stats{_calls, _datagrams, _messages, _unhandled, _malformed, _dropped};
+}
+
+void OscReceiver::_receive_loop()
+{
+  const uint batch = _config.batch;
+  std::vector<mmsghdr> headers(batch);
+  std::vector<iovec> iovecs(batch);
+  std::vector<char> control(batch * CONTROL_SIZE);
+  for (uint k = 0; k < batch; ++k) {
+    iovecs[k].iov_base = _buffers.data() + k * _config.max_datagram;
+    iovecs[k].iov_len = _config.max_datagram;
+  }
+
+  pollfd fds[2] = {{_fd, POLLIN, 0}, {_wakeup, POLLIN, 0}};
+  while (_running) {
+    if (::poll(fds, 2, -1) <= 0) {
+      continue; // Interrupted
+    }
+    if (fds[1].revents & POLLIN) {
+      uint64_t count;
+      if (::read(_wakeup, &count, sizeof(count)) < 0) {
+	// Already reset
+      }
+      continue; // Woken up to stop
+    }
+
+    // Drain the socket, whole batches at a time
+    int received;
+    do {
+      for (uint k = 0; k < batch; ++k) {
+	msghdr& hdr = headers[k].msg_hdr;
+	hdr.msg_name = &_sources[k];
+	hdr.msg_namelen = sizeof(sockaddr_storage);
+	hdr.msg_iov = &iovecs[k];
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control.data() + k * CONTROL_SIZE;
+	hdr.msg_controllen = CONTROL_SIZE;
+	hdr.msg_flags = 0;
+      }
+      received = ::recvmmsg(_fd, headers.data(), batch, MSG_DONTWAIT, nullptr);
+      if (received <= 0) {
+	break;
+      }
+      ++_calls;
+
+      for (int k = 0; k < received; ++k) {
+	msghdr& hdr = headers[k].msg_hdr;
+	for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+	  if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+	    uint32_t dropped;
+	    std::memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+	    _dropped.store(dropped, std::memory_order_relaxed);
+	  }
+	}
+	if (hdr.msg_flags & MSG_TRUNC) {
+	  ++_datagrams;
+	  ++_malformed; // Larger than max_datagram
+	  continue;
+	}
+	dispatch(static_cast<const char*>(iovecs[k].iov_base), headers[k].msg_len, &_sources[k]);
+      }
+    } while (received == static_cast<int>(batch) && _running);
+  }
+}
+
+int OscReceiver::_dispatch(const char* data, size_t size, const sockaddr_storage* source, uint depth)
+{
+  if (size >= 16 && std::memcmp(data, "#bundle", 8) == 0) {
+    if (depth >= MAX_BUNDLE_DEPTH) {
+      return -1;
+    }
+    // Time tag ignored, elements are handled right away
+    int messages = 0;
+    size_t pos = 16;
+    while (pos + 4 <= size) {
+      uint32_t element_size;
+      std::memcpy(&element_size, data + pos, 4);
+      element_size = ntohl(element_size);
+      pos += 4;
+      if (element_size > size - pos) {
+	return -1;
+      }
+      int element_messages = _dispatch(data + pos, element_size, source, depth + 1);
+      if (element_messages < 0) {
+	return -1;
+      }
+      messages += element_messages;
+      pos += element_size;
+    }
+    return messages;
+  }
+
+  Message msg;
+  if (!msg.parse(data, size)) {
+    return -1;
+  }
+  msg._source = source;
+  ++_messages;
+
+  if (_on_message) {
+    _on_message(msg);
+  }
+  auto it = _methods.find(msg.path());
+  if (it == _methods.end() || (!it->second.types.empty() && it->second.types != msg.types())) {
+    ++_unhandled;
+  } else {
+    it->second.handler(msg);
+  }
+
+  return 1;
+}
@@ -0,0 +1,182 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OSCRECEIVER_H
+#define OSCRECEIVER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+
+/**
+ * @brief Receives OSC datagrams in batches and decodes them in place.
+ *
+ * A thread drains the socket with recvmmsg(), many datagrams per system call, into a
+ * preallocated ring of buffers. Messages, also those inside bundles, are decoded
+ * without copying or allocating: handlers get views into the receive buffer. The
+ * socket can be one of a lo::Server that isn't started, so messages sent from that
+ * server still get their replies here.
+ */
+class OscReceiver {
+public:
+    /**
+     * @brief An OSC message decoded in place. Only valid during the handler call.
+     */
+    class Message {
+    public:
+      static const uint MAX_ARGS = 16;   // Further arguments are ignored
+
+      /**
+       * @brief parse Decode a serialised message.
+       * @return false if it's malformed.
+       */
+      bool parse(const char* data, size_t size);
+
+      std::string_view path() const { return _path; }
+      std::string_view types() const { return _types; }   // Without the leading ','
+      uint argc() const { return _argc; }
+
+      // Arguments by position; the type has to match types()
+      int32_t i(uint n) const;
+      float f(uint n) const;
+      int64_t h(uint n) const;
+      double d(uint n) const;
+      std::string_view s(uint n) const;
+      std::string_view b(uint n) const;   // Blob contents
+
+      // The message as received
+      const char* data() const { return _data; }
+      size_t size() const { return _size; }
+
+      // Sender, null for messages passed to dispatch()
+      const sockaddr_storage* source() const { return _source; }
+
+    private:
+      friend class OscReceiver;
+
+      const char* _data = nullptr;
+      size_t _size = 0;
+      std::string_view _path, _types;
+      uint _argc = 0;
+      uint32_t _offsets[MAX_ARGS];
+      const sockaddr_storage* _source = nullptr;
+
+      uint32_t _u32(uint n) const;
+      uint64_t _u64(uint n) const;
+    };
+
+    typedef std::function<void(const Message& msg)> Handler;
+
+    struct Config {
+      uint batch;             // Datagrams per recvmmsg() call
+      size_t max_datagram;    // Size of each receive buffer
+      int socket_buffer;      // SO_RCVBUF in bytes, 0 keeps the system default
+
+      Config() : batch{64}, max_datagram{2048}, socket_buffer{4 << 20} {}
+    };
+
+    struct Stats {
+      uint64_t calls;        // recvmmsg() calls returning data
+      uint64_t datagrams;    // Datagrams received
+      uint64_t messages;     // Messages decoded, including those in bundles
+      uint64_t unhandled;    // Messages without a matching handler
+      uint64_t malformed;    // Datagrams that aren't valid OSC
+      uint64_t dropped;      // Datagrams dropped by the kernel, if it reports them
+    };
+
+    /**
+     * @brief OscReceiver
+     * @param fd A bound UDP socket, not owned.
+     * @param config Batch and buffer sizes.
+     * @throws std::system_error if the wake-up event can't be created.
+     */
+    explicit OscReceiver(int fd, const Config& config = Config());
+    ~OscReceiver();
+
+    /**
+     * @brief add_method Register a handler for a path. Not thread-safe, add all
+     *        handlers before start().
+     * @param path Exact path, e.g. "/ch/01/mix/fader" or "node".
+     * @param types Type tags without ',' the message has to have, empty for any.
+     */
+    void add_method(const std::string& path, const std::string& types, Handler handler);
+
+    /**
+     * @brief on_message Called with every message before its handler, e.g. for
+     *        recording.
+     */
+    void on_message(Handler handler);
+
+    /**
+     * @brief start Start receiving on a thread of its own.
+     */
+    void start();
+
+    /**
+     * @brief stop Stop receiving.
+     */
+    void stop();
+
+    /**
+     * @brief dispatch Decode a serialised message or bundle and call its handlers
+     *        as if it had been received. Mustn't be called while receiving.
+     * @return Number of messages or -1 if it's malformed.
+     */
+    int dispatch(const char* data, size_t size, const sockaddr_storage* source = nullptr);
+
+    /**
+     * @brief stats Counters since construction.
+     */
+    Stats stats() const;
+
+private:
+    struct Method {
+      std::string types;
+      Handler handler;
+    };
+
+    int _fd;
+    int _wakeup;
+    Config _config;
+    std::map<std::string, Method, std::less<>> _methods;
+    Handler _on_message;
+    std::thread _thread;
+    std::atomic<bool> _running{false};
+
+    // Preallocated receive ring, only used by the receiving thread
+    std::vector<char> _buffers;
+    std::vector<sockaddr_storage> _sources;
+
+    std::atomic<uint64_t> _calls{0}, _datagrams{0}, _messages{0}, _unhandled{0}, _malformed{0};
+    std::atomic<uint64_t> _dropped{0};
+
+    void _receive_loop();
+    int _dispatch(const char* data, size_t size, const sockaddr_storage* source, uint depth);
+};
+
+#endif // OSCRECEIVER_H
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "oscrecorder.h"
+
+#include <stdexcept>
+
+OscRecorder::OscRecorder(const std::string& path) :
+  _out{path, std::ios::binary | std::ios::trunc},
+  _start{Clock::now()}
+{
+  if (!_out) {
+    throw std::runtime_error("Can't write recording " + path);
+  }
+  _out.write("XROR", 4);
+  _out.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+}
+
+OscRecorder::~OscRecorder()
+{
+  flush();
+}
+
+void OscRecorder::record(Direction direction, const char* path, const lo::Message& msg)
+{
+  uint64_t time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _start).count();
+
+  std::lock_guard<std::mutex> lock(_mtx);
+  size_t size = msg.length(path);
+  _buffer.resize(size);
+  msg.serialise(path, _buffer.data(), &size);
+  _write(time_ns, direction, _buffer.data(), size);
+}
+
+void OscRecorder::record(Direction direction, const char* data, size_t size)
+{
+  uint64_t time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _start).count();
+
+  std::lock_guard<std::mutex> lock(_mtx);
+  _write(time_ns, direction, data, size);
+}
+
+void OscRecorder::_write(uint64_t time_ns, Direction direction, const char* data, size_t size)
+{
+  uint32_t size32 = static_cast<uint32_t>(size);
+  _out.write(reinterpret_cast<const char*>(&time_ns), sizeof(time_ns));
+  _out.put(static_cast<char>(direction));
+  _out.write(reinterpret_cast<const char*>(&size32), sizeof(size32));
+  _out.write(data, size);
+}
+
+void OscRecorder::flush()
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  _out.flush();
+}
+
+std::vector<OscRecorder::Record> OscRecorder::load(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  char magic[4];
+  uint32_t version = 0;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&version), sizeof(version));
+  if (!in || std::string(magic, sizeof(magic)) != "XROR" || version != VERSION) {
+    throw std::runtime_error("Not a recording: " + path);
+  }
+
+  std::vector<Record> records;
+  for (;;) {
+    Record record;
+    char direction;
+    uint32_t size;
+    in.read(reinterpret_cast<char*>(&record.time_ns), sizeof(record.time_ns));
+    in.get(direction);
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    if (!in) {
+      break;
+    }
+    record.direction = static_cast<Direction>(direction);
+    record.data.resize(size);
+    in.read(record.data.data(), size);
+    if (!in) {
+      break; // Cut short
+    }
+    records.push_back(std::move(record));
+  }
+
+  return records;
+}
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OSCRECORDER_H
+#define OSCRECORDER_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <lo/lo_cpp.h>
+
+/**
+ * @brief Records OSC messages with timestamps to a file.
+ *
+ * The file starts with the magic "XROR" and a 32 bit format version, followed by one
+ * record per message: a 64 bit timestamp in nanoseconds since recording started, an
+ * 8 bit direction, the 32 bit message size and the message as sent on the wire. Numbers
+ * are in host byte order. The file is written as a stream, so a recording cut short
+ * is still readable up to its last complete record.
+ */
+class OscRecorder {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Direction : uint8_t { SENT = 0, RECEIVED = 1 };
+
+    struct Record {
+      uint64_t time_ns;         // Since recording started
+      Direction direction;
+      std::vector<char> data;   // Serialised message including its path
+    };
+
+    /**
+     * @brief OscRecorder Start recording to a file.
+     * @param path The file to write, replaced if it exists.
+     * @throws std::runtime_error if the file can't be written.
+     */
+    explicit OscRecorder(const std::string& path);
+    ~OscRecorder();
+
+    /**
+     * @brief record Record a message. Thread-safe.
+     * @param direction Wether the message has been sent or received.
+     * @param path The message's OSC path.
+     * @param msg The message.
+     */
+    void record(Direction direction, const char* path, const lo::Message& msg);
+
+    /**
+     * @brief record Record a message that is serialised already. Thread-safe.
+     * @param direction Wether the message has been sent or received.
+     * @param data The message as sent on the wire.
+     * @param size Its size.
+     */
+    void record(Direction direction, const char* data, size_t size);
+
+    /**
+     * @brief flush Write buffered records to the file.
+     */
+    void flush();
+
+    /**
+     * @brief load Read a recording.
+     * @param path The file to read.
+     * @return All complete records in recording order.
+     * @throws std::runtime_error if the file can't be read or isn't a recording.
+     */
+    static std::vector<Record> load(const std::string& path);
+
+private:
+    static constexpr uint32_t VERSION = 1;
+
+    std::ofstream _out;
+    Clock::time_point _start;
+    std::mutex _mtx;
+    std::vector<char> _buffer;
+
+    void _write(uint64_t time_ns, Direction direction, const char* data, size_t size);
+};
+
+#endif // OSCRECORDER_H
@@ -0,0 +1,162 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "oscreplayer.h"
+
+OscReplayer::OscReplayer(const std::vector<OscRecorder::Record>& records, const Config& config) :
+  _config{config},
+  _lo_server{config.port}
+{
+  // Tie each received message to the last message sent before it
+  uint64_t sent = 0;
+  uint64_t last_sent_ns = 0;
+  for (const auto& record : records) {
+    if (record.direction == OscRecorder::SENT) {
+      if (sent == 0) {
+	_first_request = record.data;
+      }
+      ++sent;
+      last_sent_ns = record.time_ns;
+    } else {
+      _replies.push_back(Reply{sent, std::chrono::nanoseconds(record.time_ns - last_sent_ns), record.data});
+    }
+  }
+
+  if (_lo_server.is_valid()) {
+    _lo_server.add_method(nullptr, nullptr,
+			  [this](const char* path, const lo::Message &msg) {
+			    return this->_handler(path, msg);
+			  });
+  }
+}
+
+OscReplayer::~OscReplayer()
+{
+  stop();
+}
+
+void OscReplayer::start()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (_running) {
+      return;
+    }
+    _running = true;
+    _start = Clock::now();
+  }
+  _sender = std::thread(&OscReplayer::_send_loop, this);
+  _lo_server.start();
+}
+
+void OscReplayer::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (!_running) {
+      return;
+    }
+    _running = false;
+  }
+  _lo_server.stop();
+  _cv.notify_all();
+  _sender.join();
+}
+
+bool OscReplayer::is_valid() const
+{
+  return _lo_server.is_valid();
+}
+
+std::string OscReplayer::url() const
+{
+  return _lo_server.url();
+}
+
+OscReplayer::Stats OscReplayer::stats() const
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  return Stats{_requests.size(), _sent, _replies.size() - _sent};
+}
+
+bool OscReplayer::wait(std::chrono::milliseconds timeout)
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  return _cv.wait_for(lock, timeout, [this]() { return _sent == _replies.size(); });
+}
+
+int OscReplayer::_handler(const char* path, const lo::Message& msg)
+{
+  auto now = Clock::now();
+  std::string source = msg.source().url();
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (_client_url.empty()) {
+      // Other clients, e.g. discovery or a state mirror, may talk to us as well.
+      // The client is the one starting with the recorded session's first message.
+      size_t size = msg.length(path);
+      std::vector<char> data(size);
+      msg.serialise(path, data.data(), &size);
+      if (data != _first_request) {
+	return 0;
+      }
+      _client_url = source;
+    } else if (source != _client_url) {
+      return 0;
+    }
+    _requests.push_back(now);
+  }
+  _cv.notify_all();
+
+  return 0;
+}
+
+void OscReplayer::_send_loop()
+{
+  std::unique_ptr<lo::Address> client;
+
+  std::unique_lock<std::mutex> lock(_mtx);
+  for (auto& reply : _replies) {
+    // Wait for the request the reply belongs to, then for the recorded delay
+    _cv.wait(lock, [this, &reply]() { return !_running || _requests.size() >= reply.gate; });
+    if (!_running) {
+      return;
+    }
+    auto base = reply.gate > 0 ? _requests[reply.gate - 1] : _start;
+    auto due = base + std::chrono::duration_cast<Clock::duration>(reply.delay * _config.speed);
+    if (_cv.wait_until(lock, due, [this]() { return !_running; })) {
+      return;
+    }
+    if (!client && !_client_url.empty()) {
+      client.reset(new lo::Address(_client_url));
+    }
+    lock.unlock();
+
+    if (client) {
+      const char* path = lo_get_path(reply.data.data(), reply.data.size());
+      lo::Message msg = lo::Message::deserialise(reply.data.data(), reply.data.size());
+      client->send_from(_lo_server, path, msg);
+    }
+
+    lock.lock();
+    ++_sent;
+    _cv.notify_all();
+  }
+}
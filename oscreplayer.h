@@ -0,0 +1,111 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OSCREPLAYER_H
+#define OSCREPLAYER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lo/lo_cpp.h>
+
+#include "oscrecorder.h"
+
+/**
+ * @brief Plays the mixer's side of a recorded session.
+ *
+ * The replayer listens like a mixer and answers a client with the messages received
+ * in the recording. Each reply waits for the request that preceded it in the recording,
+ * then for the delay it had after that request. So late replies, bursts and losses
+ * happen as recorded, as long as the client sends the same requests in the same order,
+ * e.g. by running the same test again. Only messages from the client that sends the
+ * recording's first message are taken into account.
+ */
+class OscReplayer {
+public:
+    struct Config {
+      int port;       // UDP port to listen on
+      double speed;   // Factor applied to recorded delays, 0 to reply as fast as possible
+
+      Config() : port{10024}, speed{1.0} {}
+    };
+
+    struct Stats {
+      uint64_t requests;   // Messages received from the client
+      uint64_t replies;    // Recorded messages sent to the client
+      uint64_t pending;    // Recorded messages not sent yet
+    };
+
+    /**
+     * @brief OscReplayer
+     * @param records A recording as read by OscRecorder::load().
+     * @param config Replay parameters.
+     */
+    OscReplayer(const std::vector<OscRecorder::Record>& records, const Config& config);
+    ~OscReplayer();
+
+    void start();
+    void stop();
+    bool is_valid() const;
+    std::string url() const;
+    Stats stats() const;
+
+    /**
+     * @brief wait Wait until all recorded messages have been sent or the timeout expired.
+     * @return true if all have been sent.
+     */
+    bool wait(std::chrono::milliseconds timeout);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Reply {
+      uint64_t gate;               // Requests to wait for
+      Clock::duration delay;       // Recorded delay after the last of those
+      std::vector<char> data;
+    };
+
+    Config _config;
+    lo::ServerThread _lo_server;
+    std::vector<Reply> _replies;
+    std::vector<char> _first_request;
+
+    // Arrival times of the client's requests, written by the server thread
+    std::vector<Clock::time_point> _requests;
+    std::string _client_url;
+    Clock::time_point _start;
+    bool _running = false;
+    mutable std::mutex _mtx;
+    std::condition_variable _cv;
+
+    std::thread _sender;
+    std::atomic<uint64_t> _sent{0};
+
+    int _handler(const char* path, const lo::Message& msg);
+    void _send_loop();
+};
+
+#endif // OSCREPLAYER_H
@@ -0,0 +1,290 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "rampengine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <system_error>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// Each tick's updates go out in one go, nothing waits for a later tick.
+static OscBatcher::Config tick_batches()
+{
+  OscBatcher::Config config;
+  config.max_delay = std::chrono::microseconds(0);
+  return config;
+}
+
+// steady_clock is CLOCK_MONOTONIC, the timerfd's clock
+static timespec to_timespec(std::chrono::nanoseconds ns)
+{
+  timespec ts;
+  ts.tv_sec = ns.count() / 1000000000;
+  ts.tv_nsec = ns.count() % 1000000000;
+  return ts;
+}
+
+RampEngine::RampEngine(const std::string& mixer_url, const Config& config) :
+  _mixer_addr{mixer_url},
+  _lo_server{nullptr},
+  _batcher{_lo_server, tick_batches()},
+  _config{config},
+  _timer{::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)},
+  _wakeup{::eventfd(0, EFD_NONBLOCK)}
+{
+  if (_timer < 0 || _wakeup < 0) {
+    int err = errno;
+    if (_timer >= 0) {
+      ::close(_timer);
+    }
+    if (_wakeup >= 0) {
+      ::close(_wakeup);
+    }
+    throw std::system_error(err, std::generic_category(), "Can't create ramp timer");
+  }
+}
+
+RampEngine::~RampEngine()
+{
+  stop();
+  ::close(_timer);
+  ::close(_wakeup);
+}
+
+void RampEngine::start()
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  if (_running) {
+    return;
+  }
+  _running = true;
+  _thread = std::thread(&RampEngine::_timer_loop, this);
+  if (!_ramps.empty()) {
+    _arm(std::max(Clock::now(), _deadline));
+  }
+}
+
+void RampEngine::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (!_running) {
+      return;
+    }
+    _running = false;
+    _disarm();
+  }
+  _cv_idle.notify_all();
+  uint64_t one = 1;
+  if (::write(_wakeup, &one, sizeof(one)) < 0) {
+    // Can't happen unless the counter overflows; the thread exits anyway.
+  }
+  _thread.join();
+}
+
+void RampEngine::fade(const std::string& path, uint from, uint to, Clock::duration duration,
+		      Curve curve, Clock::time_point start)
+{
+  auto now = Clock::now();
+  if (start == Clock::time_point()) {
+    start = now;
+  }
+  from = std::min(from, Level::getNumSteps() - 1);
+  to = std::min(to, Level::getNumSteps() - 1);
+
+  std::lock_guard<std::mutex> lock(_mtx);
+  auto inserted = _ramps.insert_or_assign(path, Ramp{from, to, start, duration, curve});
+  if (!inserted.second) {
+    ++_fades; // Replaced
+  }
+  // Someone else may have moved the fader since the last fade, so its first
+  // index is sent in any case.
+  _sent.erase(path);
+  // The timer may be waiting for a fade starting later than this one.
+  auto first_tick = std::max(now, start);
+  if (_running && (!_armed || first_tick < _deadline)) {
+    _arm(first_tick);
+  }
+}
+
+void RampEngine::crossfade(const std::string& out_path, uint out_from, const std::string& in_path,
+			   uint in_to, Clock::duration duration, Curve curve, Clock::time_point start)
+{
+  if (start == Clock::time_point()) {
+    start = Clock::now();
+  }
+  fade(out_path, out_from, 0, duration, curve, start);
+  fade(in_path, 0, in_to, duration, curve, start);
+}
+
+void RampEngine::cancel(const std::string& path)
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  if (_ramps.erase(path) > 0) {
+    ++_fades;
+  }
+  if (_ramps.empty()) {
+    _disarm();
+    _cv_idle.notify_all();
+  }
+}
+
+bool RampEngine::wait()
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  _cv_idle.wait(lock, [this]() { return _ramps.empty() || !_running; });
+  return _ramps.empty();
+}
+
+RampEngine::Stats RampEngine::stats() const
+{
+  auto sent = _batcher.stats();
+  return Stats{_fades, _ticks, _missed, sent.messages, sent.packets, _jitter.summary()};
+}
+
+void RampEngine::_arm(Clock::time_point deadline)
+{
+  _deadline = deadline;
+  itimerspec spec;
+  spec.it_value = to_timespec(deadline.time_since_epoch());
+  spec.it_interval = to_timespec(_config.tick);
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    spec.it_value.tv_nsec = 1; // Zero would disarm
+  }
+  ::timerfd_settime(_timer, TFD_TIMER_ABSTIME, &spec, nullptr);
+  _armed = true;
+}
+
+void RampEngine::_disarm()
+{
+  itimerspec spec{};
+  ::timerfd_settime(_timer, 0, &spec, nullptr);
+  _armed = false;
+}
+
+void RampEngine::_timer_loop()
+{
+  // Absolute timerfd deadlines aren't subject to timer slack, so what's left as jitter
+  // is scheduling latency. SCHED_FIFO cuts that down on a busy machine.
+  if (_config.realtime) {
+    sched_param param{};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    ::pthread_setschedparam(pthread_self(), SCHED_FIFO, &param); // Needs privileges
+  }
+
+  pollfd fds[2] = {{_timer, POLLIN, 0}, {_wakeup, POLLIN, 0}};
+  for (;;) {
+    if (::poll(fds, 2, -1) <= 0) {
+      continue; // Interrupted
+    }
+    if (fds[1].revents & POLLIN) {
+      uint64_t count;
+      if (::read(_wakeup, &count, sizeof(count)) < 0) {
+	// Already reset
+      }
+      std::lock_guard<std::mutex> lock(_mtx);
+      if (!_running) {
+	break;
+      }
+      continue;
+    }
+
+    uint64_t expirations = 0;
+    if (::read(_timer, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+      continue; // Disarmed or rearmed in between
+    }
+    auto now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (!_armed) {
+      continue;
+    }
+    // Skipped ticks are lost, the fades catch up at the current one.
+    Clock::time_point deadline = _deadline + (expirations - 1) * _config.tick;
+    _jitter.record(now - deadline);
+    _missed += expirations - 1;
+    _deadline = deadline + _config.tick;
+    _tick(deadline);
+  }
+}
+
+void RampEngine::_tick(Clock::time_point now)
+{
+  ++_ticks;
+  Level level;
+  bool active = false;
+  Clock::time_point next_start = Clock::time_point::max();
+  for (auto it = _ramps.begin(); it != _ramps.end(); ) {
+    const Ramp& ramp = it->second;
+    if (now < ramp.start) {
+      next_start = std::min(next_start, ramp.start);
+      ++it;
+      continue;
+    }
+
+    uint index = _index(ramp, now);
+    auto sent = _sent.find(it->first);
+    if (sent == _sent.end() || sent->second != index) {
+      level.setIndex(index);
+      lo::Message msg;
+      msg.add_float(level.getFloat());
+      _batcher.add(_mixer_addr, it->first, msg);
+      _sent[it->first] = index;
+    }
+
+    if (now >= ramp.start + ramp.duration) {
+      ++_fades;
+      it = _ramps.erase(it);
+    } else {
+      active = true;
+      ++it;
+    }
+  }
+  _batcher.flush();
+
+  if (_ramps.empty()) {
+    _disarm();
+    _cv_idle.notify_all();
+  } else if (!active) {
+    _arm(next_start); // Sleep until the next fade starts
+  }
+}
+
+uint RampEngine::_index(const Ramp& ramp, Clock::time_point now)
+{
+  double p = 1;
+  if (ramp.duration > Clock::duration::zero()) {
+    p = std::chrono::duration<double>(now - ramp.start) / ramp.duration;
+    p = std::clamp(p, 0.0, 1.0);
+  }
+  if (ramp.curve == SMOOTH) {
+    p = p * p * (3 - 2 * p);
+  }
+  double index = ramp.from + (static_cast<double>(ramp.to) - ramp.from) * p;
+  return static_cast<uint>(std::lround(index));
+}
@@ -0,0 +1,163 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RAMPENGINE_H
+#define RAMPENGINE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <lo/lo_cpp.h>
+
+#include "latencyhistogram.h"
+#include "oscbatcher.h"
+#include "xrm32level.hpp"
+
+/**
+ * @brief Moves faders along scheduled fades on a timer thread of its own.
+ *
+ * A timerfd on CLOCK_MONOTONIC fires at absolute deadlines, one tick interval apart,
+ * while any fade is running. Each tick evaluates every fade at the tick's deadline in
+ * the Level index domain and sends the faders whose index changed, all of them in as
+ * few bundles as possible. An index that has already been sent to a fader during its
+ * fade isn't sent again, so the engine assumes to be the fader's only writer while a
+ * fade runs. How late the ticks fire is recorded as the engine's jitter.
+ */
+class RampEngine {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef Xrm32::Level<1024> Level;
+
+    enum Curve {
+      LINEAR,   // Constant speed in fader travel
+      SMOOTH    // Eases in and out (smoothstep), no jumps in speed at either end
+    };
+
+    struct Config {
+      std::chrono::microseconds tick;   // Interval between updates
+      bool realtime;                    // Try to run the timer thread with SCHED_FIFO
+
+      Config() : tick{10000}, realtime{false} {}
+    };
+
+    struct Stats {
+      uint64_t fades;                   // Fades finished or replaced
+      uint64_t ticks;                   // Ticks handled
+      uint64_t missed;                  // Ticks skipped because the thread was too late
+      uint64_t messages, packets;       // Fader updates and datagrams sent
+      LatencyHistogram::Summary jitter; // Lateness of the ticks
+    };
+
+    /**
+     * @brief RampEngine
+     * @param mixer_url URL of the mixer, e.g. "osc.udp://192.168.1.20:10024/".
+     * @param config Tick interval.
+     * @throws std::system_error if the timer can't be created.
+     */
+    explicit RampEngine(const std::string& mixer_url, const Config& config = Config());
+    ~RampEngine();
+
+    /**
+     * @brief start Start the timer thread.
+     */
+    void start();
+
+    /**
+     * @brief stop Stop the timer thread. Running fades stay where they are.
+     */
+    void stop();
+
+    /**
+     * @brief fade Move a fader from one index to another. Replaces the fader's running
+     *        fade, if any.
+     * @param path Fader path, e.g. "/ch/01/mix/fader".
+     * @param from Index to start at, usually the fader's current one.
+     * @param to Index to end at.
+     * @param duration Length of the fade, 0 to jump at the first tick.
+     * @param curve Shape of the fade.
+     * @param start When the fade starts, now if not given.
+     */
+    void fade(const std::string& path, uint from, uint to, Clock::duration duration,
+	      Curve curve = SMOOTH, Clock::time_point start = Clock::time_point());
+
+    /**
+     * @brief crossfade Fade one fader out to -oo while another one comes in from -oo,
+     *        with the same timing.
+     */
+    void crossfade(const std::string& out_path, uint out_from, const std::string& in_path,
+		   uint in_to, Clock::duration duration, Curve curve = SMOOTH,
+		   Clock::time_point start = Clock::time_point());
+
+    /**
+     * @brief cancel Stop a fader's fade where it is.
+     */
+    void cancel(const std::string& path);
+
+    /**
+     * @brief wait Block until all fades have finished.
+     * @return false if the engine is stopped before.
+     */
+    bool wait();
+
+    /**
+     * @brief stats Counters since construction.
+     */
+    Stats stats() const;
+
+private:
+    struct Ramp {
+      uint from, to;
+      Clock::time_point start;
+      Clock::duration duration;
+      Curve curve;
+    };
+
+    lo::Address _mixer_addr;
+    lo::ServerThread _lo_server;
+    OscBatcher _batcher;
+    Config _config;
+    int _timer;
+    int _wakeup;
+
+    mutable std::mutex _mtx;
+    std::condition_variable _cv_idle;
+    std::map<std::string, Ramp> _ramps;
+    std::map<std::string, uint> _sent;    // Last index sent to each fader
+    Clock::time_point _deadline;          // Of the next tick while armed
+    bool _armed = false;
+    bool _running = false;
+    std::thread _thread;
+
+    LatencyHistogram _jitter;
+    std::atomic<uint64_t> _fades{0}, _ticks{0}, _missed{0};
+
+    void _arm(Clock::time_point deadline);
+    void _disarm();
+    void _timer_loop();
+    void _tick(Clock::time_point now);
+    static uint _index(const Ramp& ramp, Clock::time_point now);
+};
+
+#endif // RAMPENGINE_H
@@ -0,0 +1,185 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "replycorrelator.h"
+
+#include <algorithm>
+#include <cstring>
+
+ReplyCorrelator::ReplyCorrelator(size_t slots_per_key)
+{
+  size_t size = 1;
+  while (size < slots_per_key) {
+    size <<= 1;
+  }
+  _mask = size - 1;
+}
+
+ReplyCorrelator::~ReplyCorrelator()
+{
+  // Nothing to do here.
+}
+
+size_t ReplyCorrelator::add_key(const std::string& name)
+{
+  std::unique_ptr<Channel> channel(new Channel);
+  channel->name = name;
+  channel->slots.reset(new Slot[_mask + 1]);
+  _channels.push_back(std::move(channel));
+  return _channels.size() - 1;
+}
+
+ReplyCorrelator::Ticket ReplyCorrelator::issue(size_t key, uint kind)
+{
+  Channel& channel = *_channels[key];
+  uint64_t seq = channel.issued.load(std::memory_order_relaxed);
+  Slot& slot = channel.slots[seq & _mask];
+
+  // Still in use by a request 'slots_per_key' requests ago
+  if (slot.state.load(std::memory_order_acquire) != EMPTY) {
+    return Ticket{key, Ticket::INVALID};
+  }
+
+  slot.kind = kind;
+  slot.seq = seq;
+  slot.state.store(PENDING, std::memory_order_relaxed);
+  // Publishes the slot to the server thread
+  channel.issued.store(seq + 1, std::memory_order_release);
+
+  return Ticket{key, seq};
+}
+
+bool ReplyCorrelator::wait(const Ticket& ticket, Reply& reply, Clock::time_point deadline)
+{
+  if (!ticket.valid()) {
+    return false;
+  }
+
+  Slot& slot = _channels[ticket.key]->slots[ticket.seq & _mask];
+  if (!slot.done.try_acquire_until(deadline)) {
+    uint8_t expected = PENDING;
+    if (slot.state.compare_exchange_strong(expected, ABANDONED, std::memory_order_acq_rel)) {
+      // The server thread frees the slot once it passes it.
+      ++_timeouts;
+      return false;
+    }
+    // The reply arrived just now, its semaphore release is imminent.
+    slot.done.acquire();
+  }
+
+  bool ready = slot.state.load(std::memory_order_acquire) == READY;
+  if (ready) {
+    reply = slot.reply;
+  }
+  slot.state.store(EMPTY, std::memory_order_release);
+
+  return ready;
+}
+
+bool ReplyCorrelator::arm(const Ticket& ticket, Waiter* waiter)
+{
+  Slot& slot = _channels[ticket.key]->slots[ticket.seq & _mask];
+  slot.waiter.store(waiter);
+
+  // Sequentially consistent like the state change in complete(): either the server
+  // thread sees the waiter or we see the request done.
+  if (slot.state.load() == PENDING) {
+    return true;
+  }
+  // Done already. If the server thread took the waiter anyway it's being notified.
+  return slot.waiter.exchange(nullptr) == nullptr;
+}
+
+bool ReplyCorrelator::disarm(const Ticket& ticket, Waiter* waiter)
+{
+  Slot& slot = _channels[ticket.key]->slots[ticket.seq & _mask];
+  return slot.waiter.compare_exchange_strong(waiter, nullptr);
+}
+
+bool ReplyCorrelator::complete(size_t key, uint kind, float f, std::string_view s)
+{
+  Channel& channel = *_channels[key];
+  uint64_t issued = channel.issued.load(std::memory_order_acquire);
+
+  // All slots between completed and issued are either pending or abandoned.
+  while (channel.completed < issued) {
+    Slot& slot = channel.slots[channel.completed & _mask];
+    ++channel.completed;
+
+    bool match = slot.kind == kind;
+    uint8_t expected = PENDING;
+    if (slot.state.load(std::memory_order_acquire) == PENDING) {
+      if (match) {
+	slot.reply.f = f;
+	slot.reply.len = std::min(s.size(), VALUE_SIZE);
+	std::memcpy(slot.reply.s, s.data(), slot.reply.len);
+	slot.reply.received = Clock::now();
+      }
+
+      if (slot.state.compare_exchange_strong(expected, match ? READY : LOST)) {
+	// Take the waiter before releasing the slot, afterwards it may be reused
+	// and armed for a later request.
+	Waiter* waiter = slot.waiter.exchange(nullptr);
+	slot.done.release();
+	if (waiter) {
+	  waiter->notify();
+	}
+	if (match) {
+	  return true;
+	}
+	// A reply of another kind was requested earlier but never arrived.
+	++_lost;
+	continue;
+      }
+    }
+
+    // Abandoned by its caller after a timeout. A late reply still belongs to
+    // this request, so it's consumed here instead of shifting all later replies.
+    slot.state.store(EMPTY, std::memory_order_release);
+    if (match) {
+      ++_late;
+      return true;
+    }
+    ++_lost;
+  }
+
+  ++_unmatched;
+  return false;
+}
+
+uint64_t ReplyCorrelator::unmatched() const
+{
+  return _unmatched;
+}
+
+uint64_t ReplyCorrelator::lost() const
+{
+  return _lost;
+}
+
+uint64_t ReplyCorrelator::late() const
+{
+  return _late;
+}
+
+uint64_t ReplyCorrelator::timeouts() const
+{
+  return _timeouts;
+}
@@ -0,0 +1,188 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REPLYCORRELATOR_H
+#define REPLYCORRELATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <semaphore>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Matches OSC replies to outstanding requests.
+ *
+ * OSC replies carry no request id, but the mixer answers the requests concerning one
+ * path in the order it receives them. So a request is identified by a key (usually
+ * one per path) and a per-key sequence number, and each reply is matched to the
+ * oldest outstanding request of its key and kind. Requests of another kind in front
+ * of it won't get their replies anymore; their callers are woken up right away.
+ * Requests whose callers gave up waiting still take part in matching, so a late
+ * reply is consumed by its own request instead of being handed to the next one.
+ *
+ * Each key has a ring of preallocated slots. Handing a reply over to the waiting
+ * caller is lock-free: complete() never blocks, callers wait on a per-slot semaphore.
+ * Instead of blocking in wait() a caller can arm a Waiter to be notified, e.g. to
+ * resume a coroutine, and collect the reply with wait() afterwards.
+ */
+class ReplyCorrelator {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr size_t VALUE_SIZE = 128; // Longer string replies are truncated
+
+    struct Reply {
+      float f;               // Float argument, if any
+      char s[VALUE_SIZE];    // String argument, if any
+      size_t len;            // Length of s
+      Clock::time_point received;  // Arrival time, e.g. for RTT measurements
+
+      std::string_view str() const { return std::string_view(s, len); }
+    };
+
+    /**
+     * @brief Notified from the OSC server thread once a request's reply arrived or
+     *        is known to be lost, see arm().
+     */
+    struct Waiter {
+      virtual void notify() = 0;
+
+    protected:
+      ~Waiter() {}
+    };
+
+    struct Ticket {
+      size_t key;
+      uint64_t seq;          // INVALID if no slot was available
+
+      static const uint64_t INVALID = ~uint64_t(0);
+      bool valid() const { return seq != INVALID; }
+    };
+
+    /**
+     * @brief ReplyCorrelator
+     * @param slots_per_key Maximum number of outstanding requests per key,
+     *        rounded up to a power of two.
+     */
+    explicit ReplyCorrelator(size_t slots_per_key = 256);
+    ~ReplyCorrelator();
+
+    /**
+     * @brief add_key Add a key, e.g. for a path. Not thread-safe, add all keys before use.
+     * @param name Name of the key for diagnostics.
+     * @return The new key.
+     */
+    size_t add_key(const std::string& name);
+
+    /**
+     * @brief issue Reserve a slot for a request. The request has to be sent right
+     *        after issuing it; callers on different threads have to serialize
+     *        issuing and sending so both happen in the same order.
+     * @param key The request's key.
+     * @param kind Kind of reply expected, e.g. float or /node reply.
+     * @return Ticket to wait for the reply. Invalid if too many requests are outstanding.
+     */
+    Ticket issue(size_t key, uint kind);
+
+    /**
+     * @brief wait Wait for the reply to a request and release its slot.
+     * @param ticket The request's ticket.
+     * @param reply Receives the reply.
+     * @param deadline Give up waiting after this point in time.
+     * @return false if the reply timed out or is known to be lost.
+     */
+    bool wait(const Ticket& ticket, Reply& reply, Clock::time_point deadline);
+
+    /**
+     * @brief arm Have a waiter notified when the request is done instead of blocking
+     *        in wait(). The reply is collected with wait() after the notification,
+     *        which then returns right away.
+     * @param ticket The request's ticket, valid and not waited for yet.
+     * @param waiter Notified once from the server thread. Has to stay alive until
+     *        notified or disarmed.
+     * @return false if the request is done already; the waiter won't be notified then.
+     */
+    bool arm(const Ticket& ticket, Waiter* waiter);
+
+    /**
+     * @brief disarm Withdraw an armed waiter, e.g. on timeout.
+     * @return false if the waiter is being notified, i.e. the request is done.
+     */
+    bool disarm(const Ticket& ticket, Waiter* waiter);
+
+    /**
+     * @brief complete Hand a reply to the oldest outstanding request of its key and
+     *        kind. Only to be called from a single thread, the OSC server thread.
+     *        Never blocks.
+     * @return false if no request was waiting for this reply.
+     */
+    bool complete(size_t key, uint kind, float f, std::string_view s);
+
+    /**
+     * @brief unmatched Number of replies without an outstanding request, e.g. late
+     *        or duplicate ones.
+     */
+    uint64_t unmatched() const;
+
+    /**
+     * @brief lost Number of requests whose reply has been detected as lost, i.e.
+     *        overtaken by a later reply. These are lost or out of order replies.
+     */
+    uint64_t lost() const;
+
+    /**
+     * @brief late Number of replies that arrived after their caller gave up waiting.
+     */
+    uint64_t late() const;
+
+    /**
+     * @brief timeouts Number of waits that gave up at their deadline.
+     */
+    uint64_t timeouts() const;
+
+private:
+    enum State : uint8_t { EMPTY, PENDING, READY, LOST, ABANDONED };
+
+    struct Slot {
+      std::atomic<uint8_t> state{EMPTY};
+      uint kind = 0;
+      uint64_t seq = 0;
+      Reply reply;
+      std::binary_semaphore done{0};
+      std::atomic<Waiter*> waiter{nullptr};   // Armed instead of waiting on done
+    };
+
+    struct Channel {
+      std::string name;
+      std::unique_ptr<Slot[]> slots;
+      std::atomic<uint64_t> issued{0};   // Next sequence number, written by callers
+      uint64_t completed = 0;            // Oldest unhandled sequence number, server thread only
+    };
+
+    size_t _mask;
+    std::vector<std::unique_ptr<Channel>> _channels;
+    std::atomic<uint64_t> _unmatched{0}, _lost{0}, _late{0}, _timeouts{0};
+};
+
+#endif // REPLYCORRELATOR_H
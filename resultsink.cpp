@@ -0,0 +1,206 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "resultsink.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std::literals;
+
+const auto WRITE_INTERVAL = 100ms; // Records don't wait longer than this
+
+// Copies a string into a fixed size field, always null terminated
+static void copy_field(char* field, size_t size, std::string_view value)
+{
+  size_t length = std::min(value.size(), size - 1);
+  std::memcpy(field, value.data(), length);
+  std::memset(field + length, 0, size - length);
+}
+
+void ResultSink::Record::set_fader(std::string_view path)
+{
+  copy_field(fader, NAME_SIZE, path);
+}
+
+void ResultSink::Record::set_expected_db(std::string_view db)
+{
+  copy_field(expected_db, DB_SIZE, db);
+}
+
+void ResultSink::Record::set_received_db(std::string_view db)
+{
+  copy_field(received_db, DB_SIZE, db);
+}
+
+ResultSink::ResultSink(const std::string& path, Format format) :
+  _out{path, format == BINARY ? std::ios::binary | std::ios::trunc : std::ios::trunc},
+  _format{format}
+{
+  if (!_out) {
+    throw std::runtime_error("Can't write results " + path);
+  }
+
+  if (_format == BINARY) {
+    uint32_t version = VERSION, record_size = sizeof(Record);
+    _out.write("XRRS", 4);
+    _out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    _out.write(reinterpret_cast<const char*>(&record_size), sizeof(record_size));
+  } else {
+    _out << "fader,step,index,flevel,expected_float,received_float,expected_db,received_db,"
+	 << "latency_us,err\n";
+  }
+
+  _writer = std::thread(&ResultSink::_write_loop, this);
+}
+
+ResultSink::~ResultSink()
+{
+  close();
+}
+
+ResultSink::Format ResultSink::format_for(const std::string& path)
+{
+  const std::string bin = ".bin";
+  bool binary = path.size() >= bin.size() && path.compare(path.size() - bin.size(), bin.size(), bin) == 0;
+  return binary ? BINARY : CSV;
+}
+
+void ResultSink::add(const Record& record)
+{
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _pending.push_back(record);
+    ++_records;
+    wake = _pending.size() == FLUSH_RECORDS;
+  }
+  if (wake) {
+    _cv.notify_one();
+  }
+}
+
+void ResultSink::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (!_running) {
+      return;
+    }
+    _running = false;
+  }
+  _cv.notify_one();
+  _writer.join();
+  _out.close();
+}
+
+uint64_t ResultSink::records() const
+{
+  std::lock_guard<std::mutex> lock(_mtx);
+  return _records;
+}
+
+std::vector<ResultSink::Record> ResultSink::load(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  char magic[4];
+  uint32_t version = 0, record_size = 0;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&version), sizeof(version));
+  in.read(reinterpret_cast<char*>(&record_size), sizeof(record_size));
+  if (!in || std::string(magic, sizeof(magic)) != "XRRS" || version != VERSION
+      || record_size != sizeof(Record)) {
+    throw std::runtime_error("Not a binary result file: " + path);
+  }
+
+  std::vector<Record> records;
+  Record record;
+  while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+    records.push_back(record);
+  }
+
+  return records;
+}
+
+void ResultSink::_write_loop()
+{
+  // Swapped with the pending records, so adding never waits for the file
+  std::vector<Record> writing;
+  std::string buffer;
+
+  std::unique_lock<std::mutex> lock(_mtx);
+  for (;;) {
+    _cv.wait_for(lock, WRITE_INTERVAL, [this]() {
+	return !_running || _pending.size() >= FLUSH_RECORDS;
+      });
+    bool running = _running;
+    writing.swap(_pending);
+    lock.unlock();
+
+    _write(writing, buffer);
+    writing.clear();
+
+    lock.lock();
+    if (!running && _pending.empty()) {
+      break;
+    }
+  }
+  _out.flush();
+}
+
+void ResultSink::_write(const std::vector<Record>& records, std::string& buffer)
+{
+  if (records.empty()) {
+    return;
+  }
+
+  if (_format == BINARY) {
+    _out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+    return;
+  }
+
+  buffer.clear();
+  char num[32];
+  auto append = [&buffer, &num](auto value) {
+    auto end = std::to_chars(num, num + sizeof(num), value).ptr;
+    buffer.append(num, end);
+    buffer.push_back(',');
+  };
+  for (const auto& record : records) {
+    buffer.append(record.fader);
+    buffer.push_back(',');
+    append(record.step);
+    append(record.index);
+    append(record.flevel);
+    append(record.expected_float);
+    append(record.received_float);
+    buffer.append(record.expected_db);
+    buffer.push_back(',');
+    buffer.append(record.received_db);
+    buffer.push_back(',');
+    append(record.latency_us);
+    append(record.err);
+    buffer.back() = '\n';
+  }
+  _out.write(buffer.data(), buffer.size());
+}
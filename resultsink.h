@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef RESULTSINK_H
+#define RESULTSINK_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Writes per-step test results to a file on a background thread.
+ *
+ * Adding a record only appends it to a buffer in memory; a writer thread takes the
+ * whole buffer at once and formats it, so the measurement loop never waits for the
+ * file or the terminal. Results are written as CSV with a header line, or in a binary
+ * format: the magic "XRRS", a 32 bit format version and the 32 bit record size,
+ * followed by the records as they are in memory, in host byte order.
+ */
+class ResultSink {
+public:
+    enum Format { CSV, BINARY };
+
+    static const size_t NAME_SIZE = 24;   // Longer fader paths are truncated
+    static const size_t DB_SIZE = 12;     // Longer dB strings are truncated
+
+    struct Record {
+      char fader[NAME_SIZE];            // Fader path
+      uint32_t step;                    // Step number within the sweep
+      uint32_t index;                   // Index Xrm32Level expects
+      float flevel;                     // Float level that has been sent
+      float expected_float;             // Float level Xrm32Level expects
+      float received_float;             // Reported by the mixer, -1 on timeout
+      uint32_t latency_us;              // From sending the step to its last reply
+      char expected_db[DB_SIZE];        // dB string Xrm32Level expects
+      char received_db[DB_SIZE];        // Reported by the mixer, "TIMEOUT" on timeout
+      uint32_t err;                     // 1: float mismatch, 2: dB mismatch
+
+      void set_fader(std::string_view path);
+      void set_expected_db(std::string_view db);
+      void set_received_db(std::string_view db);
+    };
+
+    /**
+     * @brief ResultSink Start writing to a file.
+     * @param path The file to write, replaced if it exists.
+     * @param format CSV or binary.
+     * @throws std::runtime_error if the file can't be written.
+     */
+    ResultSink(const std::string& path, Format format);
+    ~ResultSink();
+
+    /**
+     * @brief format_for Binary for paths ending in ".bin", CSV otherwise.
+     */
+    static Format format_for(const std::string& path);
+
+    /**
+     * @brief add Queue a record for writing. Thread-safe, doesn't do any I/O.
+     */
+    void add(const Record& record);
+
+    /**
+     * @brief close Write all queued records and close the file.
+     */
+    void close();
+
+    /**
+     * @brief records Number of records added.
+     */
+    uint64_t records() const;
+
+    /**
+     * @brief load Read a binary result file.
+     * @throws std::runtime_error if the file can't be read or has another format.
+     */
+    static std::vector<Record> load(const std::string& path);
+
+private:
+    static const uint32_t VERSION = 1;
+    static const size_t FLUSH_RECORDS = 4096;   // Wake the writer at this many records
+
+    std::ofstream _out;
+    Format _format;
+    mutable std::mutex _mtx;
+    std::condition_variable _cv;
+    std::vector<Record> _pending;
+    uint64_t _records = 0;
+    bool _running = true;
+    std::thread _writer;
+
+    void _write_loop();
+    void _write(const std::vector<Record>& records, std::string& buffer);
+};
+
+#endif // RESULTSINK_H
@@ -0,0 +1,297 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "xmairemulator.h"
+
+#include <iostream>
+
+XMAirEmulator::XMAirEmulator(const Config& config) :
+  _config{config},
+  _lo_server{config.port},
+  _rng{config.seed}
+{
+  // Fader layout of an XR18
+  auto add_fader = [this](const std::string& path) {
+    _faders.emplace(path, std::unique_ptr<Xrm32::Level<1024>>(new Xrm32::Level<1024>()));
+  };
+  for (uint ch = 1; ch <= 16; ++ch) {
+    add_fader("/ch/" + std::string(ch < 10 ? "0" : "") + std::to_string(ch) + "/mix/fader");
+  }
+  for (uint i = 1; i <= 6; ++i) {
+    add_fader("/bus/" + std::to_string(i) + "/mix/fader");
+  }
+  for (uint i = 1; i <= 4; ++i) {
+    add_fader("/rtn/" + std::to_string(i) + "/mix/fader");
+    add_fader("/fxsend/" + std::to_string(i) + "/mix/fader");
+    add_fader("/dca/" + std::to_string(i) + "/fader");
+  }
+  add_fader("/rtn/aux/mix/fader");
+  add_fader("/lr/mix/fader");
+
+  if (_lo_server.is_valid()) {
+    // We dispatch on the path ourselves so that loss and rate limiting
+    // apply to every message alike.
+    _lo_server.add_method(nullptr, nullptr,
+			  [this](const char* path, const lo::Message &msg) {
+			    return this->_handler(path, msg);
+			  });
+  }
+}
+
+XMAirEmulator::~XMAirEmulator()
+{
+  stop();
+}
+
+void XMAirEmulator::start()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx_replies);
+    if (_running) {
+      return;
+    }
+    _running = true;
+  }
+  _sender = std::thread(&XMAirEmulator::_send_loop, this);
+  _lo_server.start();
+}
+
+void XMAirEmulator::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx_replies);
+    if (!_running) {
+      return;
+    }
+    _running = false;
+  }
+  _lo_server.stop();
+  _cv_replies.notify_all();
+  _sender.join();
+}
+
+bool XMAirEmulator::is_valid() const
+{
+  return _lo_server.is_valid();
+}
+
+std::string XMAirEmulator::url() const
+{
+  return _lo_server.url();
+}
+
+XMAirEmulator::Stats XMAirEmulator::stats() const
+{
+  return Stats{_received, _dropped_loss, _dropped_rate, _replies_sent};
+}
+
+std::vector<std::string> XMAirEmulator::fader_paths() const
+{
+  std::vector<std::string> paths;
+  for (const auto& fader : _faders) {
+    paths.push_back(fader.first);
+  }
+  return paths;
+}
+
+int XMAirEmulator::_handler(const char* path, const lo::Message &msg)
+{
+  ++_received;
+  auto now = Clock::now();
+
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  if (_config.loss > 0 && uniform(_rng) < _config.loss) {
+    ++_dropped_loss;
+    return 0;
+  }
+
+  // The console works through its input one message at a time. Whatever
+  // doesn't fit into the input queue is lost.
+  auto handled = now;
+  if (_config.max_rate > 0) {
+    Clock::duration interval = std::chrono::seconds(1);
+    interval /= _config.max_rate;
+    if (_next_slot < now) {
+      _next_slot = now;
+    }
+    if (_next_slot - now > interval * _config.queue_size) {
+      ++_dropped_rate;
+      return 0;
+    }
+    handled = _next_slot;
+    _next_slot += interval;
+  }
+
+  auto due = handled + _config.latency;
+  if (_config.jitter.count() > 0) {
+    std::uniform_int_distribution<long> jitter(0, _config.jitter.count());
+    due += std::chrono::microseconds(jitter(_rng));
+  }
+  // Replies never overtake each other, just like on a single network path.
+  if (due < _last_due) {
+    due = _last_due;
+  }
+  _last_due = due;
+
+  std::string path_str(path);
+  if (path_str == "/info") {
+    _handle_info(msg, due);
+  } else if (path_str == "/node") {
+    _handle_node(msg, due);
+  } else if (path_str == "/xremote") {
+    _handle_xremote(msg, due);
+  } else if (_faders.count(path_str)) {
+    _handle_fader(path_str, msg, due);
+  }
+
+  return 0;
+}
+
+void XMAirEmulator::_handle_info(const lo::Message& msg, Clock::time_point due)
+{
+  lo::Message reply;
+  reply.add_string("V0.04");
+  reply.add_string(_config.name);
+  reply.add_string(_config.model);
+  reply.add_string(_config.firmware);
+  _queue_reply(msg, due, "/info", reply);
+}
+
+void XMAirEmulator::_handle_fader(const std::string& path, const lo::Message& msg, Clock::time_point due)
+{
+  auto& level = *_faders[path];
+  std::string types = msg.types();
+  uint old_index = level.getIndex();
+
+  if (types.empty()) { // Query
+    lo::Message reply;
+    reply.add_float(level.getFloat());
+    _queue_reply(msg, due, path, reply);
+  } else if (types[0] == 'f') {
+    level.setFloat(msg.argv()[0]->f);
+  } else if (types[0] == 's') {
+    try {
+      level.setOscString(&msg.argv()[0]->s);
+    } catch (const std::exception&) {
+      // The console ignores values it can't parse
+    }
+  }
+
+  if (level.getIndex() != old_index) {
+    _push_change(path, msg, due);
+  }
+}
+
+void XMAirEmulator::_handle_node(const lo::Message& msg, Clock::time_point due)
+{
+  std::string types = msg.types();
+  if (types.empty() || types[0] != 's') {
+    return;
+  }
+
+  // Queried as "ch/13/mix/fader", answered on "node" as "/ch/13/mix/fader -10.0\n"
+  std::string node_path = &msg.argv()[0]->s;
+  if (node_path.empty() || node_path[0] != '/') {
+    node_path = "/" + node_path;
+  }
+  auto fader = _faders.find(node_path);
+  if (fader == _faders.end()) {
+    return;
+  }
+
+  node_path += ' ';
+  node_path += fader->second->getOscStringView();
+  node_path += '\n';
+  lo::Message reply;
+  reply.add_string(node_path);
+  _queue_reply(msg, due, "node", reply);
+}
+
+void XMAirEmulator::_handle_xremote(const lo::Message& msg, Clock::time_point due)
+{
+  // Like the console, push changes for 10 seconds after each /xremote
+  _subscribers[msg.source().url()] = due + std::chrono::seconds(10);
+}
+
+void XMAirEmulator::_push_change(const std::string& path, const lo::Message& msg, Clock::time_point due)
+{
+  // Changes are pushed to all other subscribers, not to the client causing them
+  std::string source = msg.source().url();
+  lo::Message change;
+  change.add_float(_faders[path]->getFloat());
+  for (auto it = _subscribers.begin(); it != _subscribers.end(); ) {
+    if (it->second < due) {
+      it = _subscribers.erase(it);
+      continue;
+    }
+    if (it->first != source) {
+      _queue_message(it->first, due, path, change);
+    }
+    ++it;
+  }
+}
+
+void XMAirEmulator::_queue_reply(const lo::Message& request, Clock::time_point due,
+				 const std::string& path, const lo::Message& reply)
+{
+  _queue_message(request.source().url(), due, path, reply);
+}
+
+void XMAirEmulator::_queue_message(const std::string& dest_url, Clock::time_point due,
+				   const std::string& path, const lo::Message& msg)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mtx_replies);
+    _replies.push_back(Reply{due, dest_url, path, msg});
+  }
+  _cv_replies.notify_one();
+}
+
+void XMAirEmulator::_send_loop()
+{
+  // Addresses of our clients, only used by this thread
+  std::map<std::string, std::unique_ptr<lo::Address>> destinations;
+
+  std::unique_lock<std::mutex> lock(_mtx_replies);
+  while (_running) {
+    if (_replies.empty()) {
+      _cv_replies.wait(lock);
+      continue;
+    }
+    auto due = _replies.front().due;
+    if (Clock::now() < due) {
+      _cv_replies.wait_until(lock, due);
+      continue;
+    }
+
+    Reply reply = std::move(_replies.front());
+    _replies.pop_front();
+    lock.unlock();
+
+    auto& dest = destinations[reply.dest_url];
+    if (!dest) {
+      dest.reset(new lo::Address(reply.dest_url));
+    }
+    dest->send_from(_lo_server, reply.path, reply.msg);
+    ++_replies_sent;
+
+    lock.lock();
+  }
+}
@@ -0,0 +1,150 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef XMAIREMULATOR_H
+#define XMAIREMULATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lo/lo_cpp.h>
+
+#include "xrm32level.hpp"
+
+/**
+ * @brief Emulates the OSC interface of an X Air / X32 mixer for offline testing.
+ *        Answers /info, fader set/get and /node fader queries using Xrm32::Level<1024>
+ *        as the fader model, and pushes fader changes to clients subscribed via
+ *        /xremote. Latency, jitter, packet loss and the message rate the "console"
+ *        is able to handle can be configured.
+ */
+class XMAirEmulator {
+public:
+    struct Config {
+      int port;                              // UDP port to listen on
+      std::chrono::microseconds latency;     // Base delay of each reply
+      std::chrono::microseconds jitter;      // Maximum additional random delay
+      double loss;                           // Probability of losing an incoming message
+      uint max_rate;                         // Messages handled per second, 0 for unlimited
+      uint queue_size;                       // Messages waiting to be handled before dropping
+      uint seed;                             // Seed for loss and jitter
+      std::string name, model, firmware;     // Reported by /info
+
+      Config() :
+	port{10024}, latency{0}, jitter{0}, loss{0.0}, max_rate{0}, queue_size{64}, seed{0},
+	name{"XR18-EMU"}, model{"XR18"}, firmware{"1.15"} {}
+    };
+
+    struct Stats {
+      uint64_t received;      // Messages received
+      uint64_t dropped_loss;  // Messages dropped due to emulated packet loss
+      uint64_t dropped_rate;  // Messages dropped because the input queue was full
+      uint64_t replies;       // Replies sent
+    };
+
+    /**
+     * @brief XMAirEmulator
+     * @param config Emulation parameters.
+     */
+    explicit XMAirEmulator(const Config& config);
+    ~XMAirEmulator();
+
+    /**
+     * @brief start Start answering requests.
+     */
+    void start();
+
+    /**
+     * @brief stop Stop answering requests.
+     */
+    void stop();
+
+    /**
+     * @brief is_valid Check wether the emulator's server could be created.
+     */
+    bool is_valid() const;
+
+    /**
+     * @brief url URL of the emulated mixer.
+     */
+    std::string url() const;
+
+    /**
+     * @brief stats Get message counters.
+     */
+    Stats stats() const;
+
+    /**
+     * @brief fader_paths All fader paths known to the emulator, e.g. "/ch/01/mix/fader".
+     */
+    std::vector<std::string> fader_paths() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Reply {
+      Clock::time_point due;
+      std::string dest_url;
+      std::string path;
+      lo::Message msg;
+    };
+
+    Config _config;
+    lo::ServerThread _lo_server;
+    std::map<std::string, std::unique_ptr<Xrm32::Level<1024>>> _faders;
+
+    // Only used from the server thread
+    std::mt19937 _rng;
+    Clock::time_point _next_slot;  // Earliest time the next message can be handled
+    Clock::time_point _last_due;   // Keeps replies in order despite jitter
+    std::map<std::string, Clock::time_point> _subscribers;  // /xremote clients and their expiry
+
+    // Delayed replies, ordered by due time
+    std::deque<Reply> _replies;
+    std::mutex _mtx_replies;
+    std::condition_variable _cv_replies;
+    std::thread _sender;
+    bool _running = false;
+
+    std::atomic<uint64_t> _received{0}, _dropped_loss{0}, _dropped_rate{0}, _replies_sent{0};
+
+    int _handler(const char* path, const lo::Message& msg);
+    void _handle_info(const lo::Message& msg, Clock::time_point due);
+    void _handle_fader(const std::string& path, const lo::Message& msg, Clock::time_point due);
+    void _handle_node(const lo::Message& msg, Clock::time_point due);
+    void _handle_xremote(const lo::Message& msg, Clock::time_point due);
+    void _push_change(const std::string& path, const lo::Message& msg, Clock::time_point due);
+    void _queue_reply(const lo::Message& request, Clock::time_point due,
+		      const std::string& path, const lo::Message& reply);
+    void _queue_message(const std::string& dest_url, Clock::time_point due,
+			const std::string& path, const lo::Message& msg);
+    void _send_loop();
+};
+
+#endif // XMAIREMULATOR_H
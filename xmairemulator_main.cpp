@@ -0,0 +1,105 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "xmairemulator.h"
+
+using namespace std::literals;
+
+static std::atomic<bool> running{true};
+
+static void usage(const char* name)
+{
+  std::cout << "Usage: " << name << " [options]"
+	    << "\n  --port N        UDP port to listen on (default 10024)"
+	    << "\n  --latency MS    Reply latency in milliseconds"
+	    << "\n  --jitter MS     Maximum additional random reply delay in milliseconds"
+	    << "\n  --loss P        Probability [0, 1] of losing an incoming message"
+	    << "\n  --rate N        Maximum number of messages handled per second"
+	    << "\n  --queue N       Input queue length used with --rate (default 64)"
+	    << "\n  --seed N        Random seed for loss and jitter"
+	    << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  XMAirEmulator::Config config;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? 0 : -1;
+    }
+    std::string val = argv[++i];
+    auto ms = [](const std::string& v) {
+      return std::chrono::microseconds(static_cast<long>(std::stod(v) * 1000));
+    };
+    if (arg == "--port") {
+      config.port = std::stoi(val);
+    } else if (arg == "--latency") {
+      config.latency = ms(val);
+    } else if (arg == "--jitter") {
+      config.jitter = ms(val);
+    } else if (arg == "--loss") {
+      config.loss = std::stod(val);
+    } else if (arg == "--rate") {
+      config.max_rate = std::stoul(val);
+    } else if (arg == "--queue") {
+      config.queue_size = std::stoul(val);
+    } else if (arg == "--seed") {
+      config.seed = std::stoul(val);
+    } else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  XMAirEmulator emulator(config);
+  if (!emulator.is_valid()) {
+    std::cout << "Could not listen on port " << config.port << "!" << std::endl;
+    return -1;
+  }
+
+  std::signal(SIGINT, [](int) { running = false; });
+  std::signal(SIGTERM, [](int) { running = false; });
+
+  emulator.start();
+  std::cout << "Emulating " << config.model << " at " << emulator.url() << std::endl;
+
+  while (running) {
+    std::this_thread::sleep_for(100ms);
+  }
+  emulator.stop();
+
+  auto stats = emulator.stats();
+  std::cout << "\nReceived: " << stats.received
+	    << "\nLost: " << stats.dropped_loss
+	    << "\nDropped (rate): " << stats.dropped_rate
+	    << "\nReplies: " << stats.replies << std::endl;
+
+  return 0;
+}
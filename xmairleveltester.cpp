@@ -20,12 +20,13 @@
 
 #include "xmairleveltester.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
-#include <future>
+#include <cstdio>
+#include <deque>
 #include <iostream>
 #include <memory>
-#include <regex>
 #include <iterator>
 #include <fstream>
 #include <sstream>
@@ -33,40 +34,67 @@
 #include "xrm32level.hpp"
 
 using namespace std::literals;
-const auto DELAY = 10ms;
-const int XMAIR_PORT = 10024;
+const uint MAX_RETRIES = 4; // Retransmissions of a lost query
+const uint SYNC_INTERVAL = 8; // Steps between extra /node queries in sweep()
 
 XMAirLevelTester::XMAirLevelTester(uint channel) :
+  XMAirLevelTester(std::vector<std::string>{channel_fader_path(channel)})
+{
+}
+
+XMAirLevelTester::XMAirLevelTester(const std::vector<std::string>& fader_paths, Receiver receiver) :
   _step{0},
-  _channel{channel},
-  _broadcast_addr{"255.255.255.255", XMAIR_PORT},
-  _xinfo_msg{"N"},
   _lo_server{nullptr},
   _fader_level_types{"f"},
-  _fader_db_types{"s"}
+  _fader_db_types{"s"},
+  _batcher{_lo_server}
 {
+  for (const auto& path : fader_paths) {
+    FaderState fader;
+    fader.path = path;
+    fader.node_query = path.substr(path.find_first_not_of('/'));
+    fader.key = _correlator.add_key(path);
+    _faders.push_back(std::move(fader));
+  }
+
+  // Messages are recorded when their datagram leaves, not when they're queued, so
+  // the batching delay doesn't end up in the recorded reply delays.
+  _batcher.on_send([this](const std::string& path, const lo::Message& msg) {
+      OscRecorder* recorder = _recorder;
+      if (recorder) {
+	recorder->record(OscRecorder::SENT, path.c_str(), msg);
+      }
+    });
+
   if (_lo_server.is_valid()) {
     std::cout << "Server is valid!" << std::endl;
 
-    // add device info handler
-    _lo_server.add_method("/info", "ssss",
+    // Sees every message first for capturing. Returning 1 passes it on to the
+    // handlers below.
+    _lo_server.add_method(nullptr, nullptr,
 			  [this](const char* path, const lo::Message &msg) {
-			    return this->_info_handler(path, msg);
+			    OscRecorder* recorder = _recorder;
+			    if (recorder) {
+			      recorder->record(OscRecorder::RECEIVED, path, msg);
+			    }
+			    return 1;
 			  });
 
-    // Build path for fader handler
-    std::string channel_num = _channel < 10 ? "0" + std::to_string(_channel)
-					 : std::to_string(_channel);
-    _fader_level_path = "/ch/" + channel_num + "/mix/fader";
+    for (size_t i = 0; i < _faders.size(); ++i) {
+      // Add fader handler
+      _lo_server.add_method(_faders[i].path.c_str(), "f",
+			    [this, i](const char* path, const lo::Message &msg)
+			    {
+			      return this->_fader_float_handler(i, msg);
+			    });
+      // Add handler for the fader's dB node replies
+      _node_dispatcher.add(_faders[i].path,
+			   [this, i](std::string_view path, std::string_view value)
+			   {
+			     this->_fader_db_reply(i, value);
+			   });
+    }
 
-    // Add fader handler
-    _lo_server.add_method(_fader_level_path.c_str(), "f",
-			  [this](const char* path, const lo::Message &msg)
-			  {
-			    return this->_fader_float_handler(path, msg);
-			  });
-    // Build path for fader dB handler
-    _fader_db_node_msg = "ch/" + channel_num + "/mix/fader";
     // Add fader db handler
     _lo_server.add_method("node", "s",
 			  [this](const char* path, const lo::Message &msg)
@@ -75,7 +103,28 @@ XMAirLevelTester::XMAirLevelTester(uint channel) :
 			  });
 
     std::cout << "Tester URL: " << _lo_server.url() << std::endl;
-    _lo_server.start();
+    if (receiver == BATCH_RECEIVER) {
+      // The server isn't started, its socket is read by the receiver. Replies
+      // reach it since everything is sent from the server.
+      _receiver.reset(new OscReceiver(_lo_server.socket_fd()));
+      _receiver->on_message([this](const OscReceiver::Message& msg) {
+	  OscRecorder* recorder = _recorder;
+	  if (recorder) {
+	    recorder->record(OscRecorder::RECEIVED, msg.data(), msg.size());
+	  }
+	});
+      for (size_t i = 0; i < _faders.size(); ++i) {
+	_receiver->add_method(_faders[i].path, "f", [this, i](const OscReceiver::Message& msg) {
+	    this->_fader_float_reply(i, msg.f(0));
+	  });
+      }
+      _receiver->add_method("node", "s", [this](const OscReceiver::Message& msg) {
+	  _node_dispatcher.dispatch(msg.s(0));
+	});
+      _receiver->start();
+    } else {
+      _lo_server.start();
+    }
   }
 }
 
@@ -86,37 +135,273 @@ XMAirLevelTester::~XMAirLevelTester()
 
 void XMAirLevelTester::stop()
 {
-  _lo_server.stop();
+  _batcher.flush(); // While the destinations are still valid
+  {
+    std::lock_guard<std::mutex> lock(_mtx_export);
+    _exporting = false;
+  }
+  _cv_export.notify_all();
+  if (_exporter.joinable()) {
+    _exporter.join();
+    _write_stats(_export_path); // Final statistics of the run
+  }
+  if (_receiver) {
+    _receiver->stop();
+  } else {
+    _lo_server.stop();
+  }
+}
+
+std::string XMAirLevelTester::channel_fader_path(uint channel)
+{
+  std::string channel_num = channel < 10 ? "0" + std::to_string(channel)
+					 : std::to_string(channel);
+  return "/ch/" + channel_num + "/mix/fader";
+}
+
+std::vector<std::string> XMAirLevelTester::fader_paths() const
+{
+  std::vector<std::string> paths;
+  for (const auto& fader : _faders) {
+    paths.push_back(fader.path);
+  }
+  return paths;
+}
+
+void XMAirLevelTester::run_tests(const lo::Address& mixer, uint num_steps, bool log = true, uint window)
+{
+  std::cout << "Running tests on mixer at " <<  mixer.url() << " on";
+  for (const auto& fader : _faders) {
+    std::cout << " " << fader.path;
+    if (window == 0) {
+      break; // Serial tests only use the first fader
+    }
+  }
+  std::cout << "." << std::endl;
+
+  if (window > 0) {
+    report(sweep(mixer, num_steps, window), log);
+  } else {
+    report({_serial_sweep(mixer, num_steps)}, log);
+  }
 }
 
-lo::Address* XMAirLevelTester::find_mixer()
+void XMAirLevelTester::report(const std::vector<std::vector<StepResult>>& results, bool log)
 {
-  // We get a future. The promise will be set by the _fader_handler.
-  auto future_mixer_addr = _promise_mixer_addr.get_future();
-  _broadcast_addr.send_from(_lo_server,  "/info", "N", nullptr);
-  auto status = future_mixer_addr.wait_for(std::chrono::seconds(1));
+  for (size_t f = 0; f < results.size(); ++f) {
+    uint mismatch_counter_float = 0;
+    uint mismatch_counter_db =0;
+    std::vector<size_t> mismatch_indices;
+
+    if (log && !_sink) {
+      std::cout << _faders[f].path << ":\n";
+    }
+    for (size_t i = 0; i < results[f].size(); ++i) {
+      int err = _evaluate(f, results[f][i], log);
+      if (1 & err) {
+	++mismatch_counter_float;
+      }
+      if (2 & err) {
+	++mismatch_counter_db;
+      }
+      if (err > 0) {
+	mismatch_indices.push_back(i);
+      }
+    }
+
+    std::cout << "===========" << std::endl;
+    std::cout << "Fader: " << _faders[f].path << std::endl;
+    std::cout << "Number of mismatches(float): " << mismatch_counter_float << std::endl;
+    std::cout << "Number of mismatches(db): " << mismatch_counter_db << std::endl;
+    std::cout << "\nMismatches:" << std::endl;
+
+    for (auto i : mismatch_indices) {
+      evaluate_step(results[f][i], true); // always log mismatches
+    }
+    std::cout << std::endl;
+  }
+
+  auto stats = _pacer.stats();
+  std::cout << "Link: " << stats.rate << " msg/s, SRTT "
+	    << std::chrono::duration<double, std::milli>(stats.srtt).count() << " ms, timeout "
+	    << std::chrono::duration<double, std::milli>(stats.rto).count() << " ms, "
+	    << stats.losses << " lost replies, " << _retransmissions << " retransmissions\n"
+	    << std::endl;
+}
+
+std::vector<std::vector<XMAirLevelTester::StepResult>>
+XMAirLevelTester::sweep(const lo::Address& mixer_addr, uint num_steps, uint window)
+{
+  std::vector<float> flevels;
+  flevels.reserve(num_steps);
+  for (uint i = 0; i < num_steps; ++i) {
+    flevels.push_back(num_steps > 1 ? i * 1.0f/(num_steps - 1) : 0.f);
+  }
+
+  return sweep(mixer_addr, flevels, window);
+}
+
+std::vector<std::vector<XMAirLevelTester::StepResult>>
+XMAirLevelTester::sweep(const lo::Address& mixer_addr, const std::vector<float>& flevels, uint window)
+{
+  if (window == 0) {
+    window = 1;
+  }
+  uint num_steps = flevels.size();
+
+  std::vector<std::vector<StepResult>> results(_faders.size());
+  for (auto& fader_results : results) {
+    fader_results.reserve(num_steps);
+    for (uint i = 0; i < num_steps; ++i) {
+      fader_results.push_back(StepResult{i, flevels[i], -1.0f, "TIMEOUT"});
+    }
+  }
+
+  // Steps in flight, oldest first
+  struct InFlight {
+    size_t fader;
+    uint step;
+    ReplyCorrelator::Ticket float_ticket, node_ticket;
+    ReplyCorrelator::Ticket sync_ticket{0, ReplyCorrelator::Ticket::INVALID};
+    ReplyCorrelator::Clock::time_point sent, deadline;
+    uint64_t last_msg;   // Sequence number of the step's last message in the batcher
+  };
+  std::deque<InFlight> in_flight;
+
+  // Waits for a reply and feeds the outcome to the pacer and the statistics
+  auto wait = [this](const InFlight& step, const ReplyCorrelator::Ticket& ticket,
+		     ReplyKind kind, ReplyCorrelator::Reply& reply) {
+    if (!ticket.valid()) {
+      return false;
+    }
+    bool ready = _correlator.wait(ticket, reply, step.deadline);
+    if (ready) {
+      _pacer.on_reply(reply.received - step.sent);
+      _rtt[kind].record(reply.received - step.sent);
+    } else {
+      _pacer.on_loss();
+    }
+    return ready;
+  };
+
+  auto collect = [this, &results, &wait, &mixer_addr](const InFlight& step) {
+    // Usually the step has been sent long ago with a full bundle, otherwise
+    // its bundle has to go out now.
+    _batcher.flush(step.last_msg);
+    auto& result = results[step.fader][step.step];
+    ReplyCorrelator::Reply reply;
+    auto last_reply = step.sent;
+    bool have_float = wait(step, step.float_ticket, FLOAT_REPLY, reply);
+    if (have_float) {
+      result.fader_float = reply.f;
+      last_reply = reply.received;
+    }
+    bool have_node = wait(step, step.node_ticket, NODE_REPLY, reply);
+    if (have_node) {
+      result.node_db = reply.str();
+      last_reply = std::max(last_reply, reply.received);
+    }
+    wait(step, step.sync_ticket, NODE_REPLY, reply);
+
+    if (!have_float || !have_node) {
+      _retransmit_step(mixer_addr, step.fader, result, have_float, have_node);
+      last_reply = ReplyCorrelator::Clock::now();
+    }
+    result.latency = last_reply - step.sent;
+  };
+
+  // Interleave the faders step by step. The window limits the steps in
+  // flight over all faders since they share the mixer.
+  //
+  // A reply that times out isn't necessarily lost: a late one still completes its
+  // own, abandoned request. Real losses show up as kind mismatches: a single lost
+  // reply is detected by the reply of the other kind following it.
+  // Losing a node reply and the next float reply however shifts all further
+  // replies by one step without any kind mismatch. An extra /node query every
+  // SYNC_INTERVAL steps breaks the float/node pattern, so such a shift ends at the
+  // next one. Its reply is the same as the step's node reply, so it doesn't matter
+  // if it's handed to the step's ticket instead.
+  for (uint i = 0; i < num_steps; ++i) {
+    for (size_t f = 0; f < _faders.size(); ++f) {
+      if (in_flight.size() >= window) {
+	collect(in_flight.front());
+	in_flight.pop_front();
+      }
+
+      const auto& fader = _faders[f];
+      InFlight step{f, i};
+      bool sync = i % SYNC_INTERVAL == SYNC_INTERVAL - 1;
+      _pace(sync ? 4 : 3);
+      {
+	std::lock_guard<std::mutex> lock(_mtx_send);
+	_send(mixer_addr, fader.path, results[f][i].flevel);
+	step.float_ticket = _correlator.issue(fader.key, FLOAT_REPLY);
+	_send(mixer_addr, fader.path);
+	step.node_ticket = _correlator.issue(fader.key, NODE_REPLY);
+	step.last_msg = _send(mixer_addr, "/node", fader.node_query.c_str());
+	if (sync) {
+	  step.sync_ticket = _correlator.issue(fader.key, NODE_REPLY);
+	  step.last_msg = _send(mixer_addr, "/node", fader.node_query.c_str());
+	}
+      }
+      step.sent = ReplyCorrelator::Clock::now();
+      step.deadline = step.sent + _pacer.timeout();
+      in_flight.push_back(step);
+    }
+  }
+
+  while (!in_flight.empty()) {
+    collect(in_flight.front());
+    in_flight.pop_front();
+  }
 
-   if (status != std::future_status::ready) {
-     std::cout << "find_mixer() returns nullptr." << std::endl;
-     return nullptr;
-   }
+  return results;
+}
 
-   auto mixer_ptr = future_mixer_addr.get();
+std::vector<XMAirLevelTester::StepResult>
+XMAirLevelTester::_serial_sweep(const lo::Address& mixer_addr, uint num_steps)
+{
+  std::vector<StepResult> results;
+  results.reserve(num_steps);
+  for (uint i = 0; i < num_steps; ++i) {
+    float flevel = num_steps > 1 ? i * 1.0f/(num_steps - 1) : 0.f;
+    auto start = std::chrono::steady_clock::now();
+    set_fader_float(mixer_addr, flevel);
+    float fader_float = query_fader_float(mixer_addr);
+    results.push_back(StepResult{i, flevel, fader_float, query_fader_db(mixer_addr)});
+    results.back().latency = std::chrono::steady_clock::now() - start;
+  }
 
-   return mixer_ptr;
+  return results;
 }
 
-void XMAirLevelTester::run_tests(const lo::Address& mixer, uint num_steps, bool log = true)
+uint XMAirLevelTester::record_golden(const std::vector<StepResult>& results, GoldenTable& table)
 {
-  uint mismatch_counter_float = 0;
-  uint mismatch_counter_db =0;
+  uint stored = 0;
+  for (const auto& result : results) {
+    if (result.fader_float < 0 || result.node_db == "TIMEOUT") {
+      continue;
+    }
+    if (table.store(result.flevel, result.fader_float, result.node_db)) {
+      ++stored;
+    }
+  }
+
+  return stored;
+}
 
-  std::vector<int> mismatch_indices;
-  std::cout << "Running tests on mixer at " <<  mixer.url()
-	    << " on channel " << _channel << "." << std::endl;
+int XMAirLevelTester::verify_golden(const GoldenTable& table, bool log)
+{
+  uint checked = 0, mismatch_counter_float = 0, mismatch_counter_db = 0;
+  std::vector<StepResult> mismatches;
 
-  for (int i = 0; i < num_steps; ++i) {
-    int err = check_fader_level(mixer, i * 1.0f/(num_steps - 1), log);
+  for (uint step = 0; step < GoldenTable::NUM_STEPS; ++step) {
+    if (!table.has(step)) {
+      continue;
+    }
+    const auto& entry = table.entry(step);
+    StepResult result{step, entry.flevel, entry.fader_float, std::string(entry.db_string())};
+    int err = evaluate_step(result, log);
     if (1 & err) {
       ++mismatch_counter_float;
     }
@@ -124,51 +409,204 @@ void XMAirLevelTester::run_tests(const lo::Address& mixer, uint num_steps, bool
       ++mismatch_counter_db;
     }
     if (err > 0) {
-      mismatch_indices.push_back(i);
+      mismatches.push_back(result);
     }
+    ++checked;
   }
 
-  // std::this_thread::sleep_for(500ms);
   std::cout << "===========" << std::endl;
+  std::cout << "Golden table: " << checked << " of " << GoldenTable::NUM_STEPS << " steps" << std::endl;
   std::cout << "Number of mismatches(float): " << mismatch_counter_float << std::endl;
   std::cout << "Number of mismatches(db): " << mismatch_counter_db << std::endl;
   std::cout << "\nMismatches:" << std::endl;
-
-  for (auto i : mismatch_indices) {
-    check_fader_level(mixer, i * 1.0f/(num_steps - 1), true); // always log mismatches
+  for (const auto& result : mismatches) {
+    evaluate_step(result, true); // always log mismatches
   }
   std::cout << std::endl;
+
+  return mismatches.size();
 }
 
+XMAirLevelTester::NodeDbMap XMAirLevelTester::map_node_db(const lo::Address& mixer_addr, uint window)
+{
+  typedef Xrm32::Level<1024> Level;
+  const uint num_indices = Level::getNumSteps();
+
+  std::vector<std::string> predicted(num_indices);
+  Level level;
+  for (uint i = 0; i < num_indices; ++i) {
+    level.setIndex(i);
+    predicted[i] = level.getOscString();
+  }
+
+  NodeDbMap map{std::vector<std::string>(num_indices, "TIMEOUT"), 0, 0, 0, {}};
+  std::vector<bool> known(num_indices, false);
+
+  // One index per predicted string, the first of its run, and the last index
+  std::vector<uint> pending;
+  for (uint i = 0; i < num_indices; ++i) {
+    if (i == 0 || i == num_indices - 1 || predicted[i] != predicted[i - 1]) {
+      pending.push_back(i);
+    }
+  }
+
+  uint failed_rounds = 0;
+  while (!pending.empty()) {
+    auto node_dbs = _probe_node_db(mixer_addr, pending, window);
+    map.probes += pending.size();
+    ++map.rounds;
+
+    std::vector<uint> timed_out;
+    for (size_t k = 0; k < pending.size(); ++k) {
+      if (node_dbs[k] != "TIMEOUT") {
+	map.node_db[pending[k]] = node_dbs[k];
+	known[pending[k]] = true;
+      } else {
+	timed_out.push_back(pending[k]);
+      }
+    }
+    if (timed_out.size() == pending.size() && ++failed_rounds > MAX_RETRIES) {
+      break; // The mixer stopped answering
+    }
+
+    // Fill the ranges between known indices that are constant or, where the
+    // console agrees with the prediction on both ends, hold a single predicted
+    // transition at their end. Bisect the others.
+    pending = timed_out;
+    int last = -1;
+    for (uint i = 0; i < num_indices; ++i) {
+      if (!known[i]) {
+	continue;
+      }
+      if (last >= 0 && i - last > 1) {
+	bool as_predicted = map.node_db[last] == predicted[last] && map.node_db[i] == predicted[i]
+	  && predicted[i - 1] == predicted[last];
+	if (map.node_db[last] == map.node_db[i] || as_predicted) {
+	  for (uint j = last + 1; j < i; ++j) {
+	    map.node_db[j] = map.node_db[last];
+	    known[j] = true;
+	  }
+	} else if (std::find(timed_out.begin(), timed_out.end(), (last + i) / 2) == timed_out.end()) {
+	  pending.push_back((last + i) / 2);
+	}
+      }
+      last = i;
+    }
+    std::sort(pending.begin(), pending.end());
+  }
+
+  for (uint i = 0; i < num_indices; ++i) {
+    if (i == 0 || map.node_db[i] != map.node_db[i - 1]) {
+      ++map.distinct;
+    }
+    if (i > 0 && known[i] && known[i - 1]
+	&& (map.node_db[i] != map.node_db[i - 1]) != (predicted[i] != predicted[i - 1])) {
+      map.unpredicted.push_back(i);
+    }
+  }
 
-int XMAirLevelTester::count_node_db(const lo::Address& mixer_addr)
+  return map;
+}
+
+std::vector<std::string> XMAirLevelTester::_probe_node_db(const lo::Address& mixer_addr,
+							  const std::vector<uint>& indices, uint window)
 {
-  std::cout << "Counting distinct dB (node string )values!";
-  std::string last_db("");
-  int count = 0;
-  for (int i = 0; i < 1024; ++i) {
-    std::cout << ".";
-    std::cout.flush();
-    float flevel = i * 1.0f/(1024 - 1);
-    set_fader_float(mixer_addr, flevel);
-    // Query dB string
-    auto node_db = query_fader_db(mixer_addr);
-    if (node_db != last_db) {
-      ++count;
-      last_db = node_db;
+  if (window == 0) {
+    window = 1;
+  }
+  const auto& fader = _faders.front();
+  std::vector<std::string> node_dbs(indices.size(), "TIMEOUT");
+
+  // Probes in flight, oldest first
+  struct InFlight {
+    size_t probe;
+    ReplyCorrelator::Ticket ticket;
+    ReplyCorrelator::Clock::time_point sent, deadline;
+    uint64_t last_msg;
+  };
+  std::deque<InFlight> in_flight;
+
+  // All replies are /node replies, so a lost one would hand every later reply to
+  // the probe before it. After a timeout the replies still in flight are dropped
+  // and a float query realigns the correlator: its reply completes the lost
+  // requests in front of it.
+  bool lost = false;
+  auto collect = [&](const InFlight& probe) {
+    _batcher.flush(probe.last_msg);
+    ReplyCorrelator::Reply reply;
+    if (_correlator.wait(probe.ticket, reply, probe.deadline)) {
+      _pacer.on_reply(reply.received - probe.sent);
+      _rtt[NODE_REPLY].record(reply.received - probe.sent);
+      if (!lost) {
+	node_dbs[probe.probe] = reply.str();
+      }
+    } else if (probe.ticket.valid()) {
+      _pacer.on_loss();
+      lost = true;
+    }
+  };
+  auto resync = [&]() {
+    while (!in_flight.empty()) {
+      collect(in_flight.front());
+      in_flight.pop_front();
+    }
+    if (lost) {
+      ReplyCorrelator::Reply reply;
+      _query(mixer_addr, fader, FLOAT_REPLY, reply);
+      lost = false;
+    }
+  };
+
+  for (size_t k = 0; k < indices.size(); ++k) {
+    if (in_flight.size() >= window) {
+      collect(in_flight.front());
+      in_flight.pop_front();
+    }
+    if (lost) {
+      resync();
+    }
+
+    InFlight probe{k};
+    _pace(2);
+    {
+      std::lock_guard<std::mutex> lock(_mtx_send);
+      _send(mixer_addr, fader.path, indices[k] * 1.0f/(Xrm32::Level<1024>::getNumSteps() - 1));
+      probe.ticket = _correlator.issue(fader.key, NODE_REPLY);
+      probe.last_msg = _send(mixer_addr, "/node", fader.node_query.c_str());
     }
+    probe.sent = ReplyCorrelator::Clock::now();
+    probe.deadline = probe.sent + _pacer.timeout();
+    in_flight.push_back(probe);
   }
-  std::cout << std::endl;
-  std::cout << "Counted " << count << " distinct dB values." << std::endl;
-  return count;
+  resync();
+
+  return node_dbs;
+}
+
+int XMAirLevelTester::count_node_db(const lo::Address& mixer_addr, uint window)
+{
+  std::cout << "Counting distinct dB (node string) values!" << std::endl;
+  auto map = map_node_db(mixer_addr, window);
+
+  std::cout << "Counted " << map.distinct << " distinct dB values, queried " << map.probes
+	    << " of " << map.node_db.size() << " indices in " << map.rounds << " rounds." << std::endl;
+  Xrm32::Level<1024> level;
+  for (auto i : map.unpredicted) {
+    level.setIndex(i - 1);
+    std::cout << "Unpredicted boundary between index " << i - 1 << " (" << map.node_db[i - 1]
+	      << ", predicted " << level.getOscStringView() << ")";
+    level.setIndex(i);
+    std::cout << " and " << i << " (" << map.node_db[i] << ", predicted "
+	      << level.getOscStringView() << ")" << std::endl;
+  }
+  return map.distinct;
 }
 
 
 int XMAirLevelTester::check_fader_level(const lo::Address& mixer_addr, float flevel, bool log)
 {
-  int err = 0;
-  Xrm32::Level<1024> level; // Our Level implementation
-  level.setFloat(flevel);
+  auto start = std::chrono::steady_clock::now();
+
   // Send a set message to the console
   set_fader_float(mixer_addr, flevel);
 
@@ -178,6 +616,50 @@ int XMAirLevelTester::check_fader_level(const lo::Address& mixer_addr, float fle
   // Query dB string
   auto node_db = query_fader_db(mixer_addr);
 
+  StepResult result{0, flevel, actual_fader_level, node_db};
+  result.latency = std::chrono::steady_clock::now() - start;
+  return _evaluate(0, result, log);
+}
+
+void XMAirLevelTester::set_result_sink(ResultSink* sink)
+{
+  _sink = sink;
+}
+
+int XMAirLevelTester::_evaluate(size_t fader, const StepResult& result, bool log)
+{
+  ResultSink* sink = _sink;
+  int err = evaluate_step(result, log && !sink);
+  if (!sink) {
+    return err;
+  }
+
+  Xrm32::Level<1024> level;
+  level.setFloat(result.flevel);
+  ResultSink::Record record;
+  record.set_fader(_faders[fader].path);
+  record.step = result.step;
+  record.index = level.getIndex();
+  record.flevel = result.flevel;
+  record.expected_float = level.getFloat();
+  record.received_float = result.fader_float;
+  record.latency_us = std::chrono::duration_cast<std::chrono::microseconds>(result.latency).count();
+  record.set_expected_db(level.getOscStringView());
+  record.set_received_db(result.node_db);
+  record.err = err;
+  sink->add(record);
+
+  return err;
+}
+
+int XMAirLevelTester::evaluate_step(const StepResult& result, bool log)
+{
+  int err = 0;
+  Xrm32::Level<1024> level; // Our Level implementation
+  level.setFloat(result.flevel);
+  const auto& actual_fader_level = result.fader_float;
+  const auto& node_db = result.node_db;
+
   // Diagnostics
   if (log) {
     std:: cout << "Index: " << level.getIndex()
@@ -185,16 +667,16 @@ int XMAirLevelTester::check_fader_level(const lo::Address& mixer_addr, float fle
 	       << "   Received float: " << actual_fader_level
 	       << "   Match(float): " << (actual_fader_level == level.getFloat())
 	       << "   dB: " << level.getDb()
-	       << "   level.getOscString(): " << level.getOscString()
+	       << "   level.getOscString(): " << level.getOscStringView()
 	       << "   node_db: " << node_db
-	       << "   Match(dB): " << (node_db == level.getOscString())
-	       << std::endl;
+	       << "   Match(dB): " << (node_db == level.getOscStringView())
+	       << '\n'; // Flushed by the summary, not after every step
   }
   if (actual_fader_level != level.getFloat()) {
     err = 1;
   }
 
-  if(node_db != level.getOscString()) {
+  if(node_db != level.getOscStringView()) {
     err |= 1 << 1;
   }
 
@@ -203,92 +685,394 @@ int XMAirLevelTester::check_fader_level(const lo::Address& mixer_addr, float fle
 
 void XMAirLevelTester::set_fader_float(const lo::Address& mixer_addr, float flevel)
 {
-  mixer_addr.send_from(_lo_server, _fader_level_path.c_str(), "f", flevel);
-  std::this_thread::sleep_for(DELAY); // Make sure the mixer isn't overrun by requests
+  _pace(); // Make sure the mixer isn't overrun by requests
+  _send(mixer_addr, _faders.front().path, flevel);
+  _batcher.flush();
 }
 
 float XMAirLevelTester::query_fader_float(const lo::Address& mixer_addr)
 {
-  auto future_fader_level = _promise_fader_level.get_future();
-  mixer_addr.send_from(_lo_server,_fader_level_path.c_str(), "", nullptr);
-  auto status = future_fader_level.wait_for(std::chrono::seconds(1));
-  float retval = status == std::future_status::ready ? future_fader_level.get() : -1.0f;
+  ReplyCorrelator::Reply reply;
+  bool ready = _query(mixer_addr, _faders.front(), FLOAT_REPLY, reply);
 
-  return retval;
+  return ready ? reply.f : -1.0f;
 }
 
 void XMAirLevelTester::set_fader_db(const lo::Address& mixer_addr, std::string db)
 {
-  mixer_addr.send_from(_lo_server,  _fader_level_path.c_str(), "s", db.c_str());
-  std::this_thread::sleep_for(DELAY); // Make sure the mixer isn't overrun by requests
+  _pace(); // Make sure the mixer isn't overrun by requests
+  _send(mixer_addr, _faders.front().path, db.c_str());
+  _batcher.flush();
 }
 
 std::string XMAirLevelTester::query_fader_db(const lo::Address& mixer_addr)
 {
-  auto future_fader_db = _promise_fader_db.get_future();
-  mixer_addr.send_from(_lo_server,"/node", "s", _fader_db_node_msg.c_str());
-  auto status = future_fader_db.wait_for(std::chrono::seconds(1));
-  std::string retval = status == std::future_status::ready ? future_fader_db.get() : "TIMEOUT";
+  ReplyCorrelator::Reply reply;
+  bool ready = _query(mixer_addr, _faders.front(), NODE_REPLY, reply);
 
-  return retval;
+  return ready ? std::string(reply.str()) : "TIMEOUT";
 }
 
-int XMAirLevelTester::_fader_float_handler(const char* path, const lo::Message &msg)
+std::string XMAirLevelTester::stats_json() const
 {
-  // Use a lock guard to keep this code from being called concurrently
-  std::lock_guard<std::mutex> lock(_mtx_fader_float);
-  float received_value = msg.argv()[0]->f;
-  // We need a new promise so that the handler can be called repeatedly
-  std::promise<float> promise_tmp;
-  std::swap(promise_tmp, _promise_fader_level);
-  promise_tmp.set_value(received_value);
-  return 1;
+  auto link = _pacer.stats();
+  auto batches = _batcher.stats();
+  auto us = [](AdaptivePacer::Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  };
+
+  std::ostringstream json;
+  json << "{\n  \"time\": " << std::chrono::duration<double>(
+	    std::chrono::system_clock::now().time_since_epoch()).count()
+       << ",\n  \"tester\": \"" << _lo_server.url() << "\""
+       << ",\n  \"faders\": [";
+  for (size_t f = 0; f < _faders.size(); ++f) {
+    json << (f > 0 ? ", " : "") << "\"" << _faders[f].path << "\"";
+  }
+  json << "],\n  \"latency\": {"
+       << "\n    \"send_wait\": " << _send_wait.json()
+       << ",\n    \"float_query\": " << _rtt[FLOAT_REPLY].json()
+       << ",\n    \"node_query\": " << _rtt[NODE_REPLY].json()
+       << "\n  },\n  \"timeouts\": " << _correlator.timeouts()
+       << ",\n  \"retransmissions\": " << _retransmissions
+       << ",\n  \"out_of_order\": " << _correlator.lost()
+       << ",\n  \"late\": " << _correlator.late()
+       << ",\n  \"unmatched\": " << _correlator.unmatched()
+       << ",\n  \"link\": {\"rate\": " << link.rate << ", \"srtt_us\": " << us(link.srtt)
+       << ", \"rto_us\": " << us(link.rto) << ", \"losses\": " << link.losses << "}"
+       << ",\n  \"sent\": {\"messages\": " << batches.messages << ", \"packets\": " << batches.packets
+       << "}";
+  if (_receiver) {
+    auto received = _receiver->stats();
+    json << ",\n  \"received\": {\"calls\": " << received.calls << ", \"datagrams\": " << received.datagrams
+	 << ", \"messages\": " << received.messages << ", \"unhandled\": " << received.unhandled
+	 << ", \"malformed\": " << received.malformed << ", \"dropped\": " << received.dropped << "}";
+  }
+  json << "\n}\n";
+
+  return json.str();
 }
 
-int XMAirLevelTester::_fader_db_handler(const char* path, const lo::Message &msg)
+void XMAirLevelTester::export_stats(const std::string& path, std::chrono::milliseconds interval)
 {
-  // Use a lock guard to keep this code from being called concurrently
-  std::lock_guard<std::mutex> lock(_mtx_fader_db);
-  std::string node_reply = &msg.argv()[0]->s;
-  // As a reply to our node query we  expect messages from the mixer on path "node"
-  // of the form "/ch/12/mix/fader -10.0". The last part is the "Node" dB value as
-  // a string.
-  std::string regex_str = "(" + _fader_level_path + ")(\\s+)(.*)(\\s*)";
-  std::regex fader_regex(regex_str);
-  std::smatch match;
+  if (_exporter.joinable()) {
+    return; // Already exporting
+  }
+
+  _export_path = path;
+  _exporting = true;
+  _exporter = std::thread([this, interval]() {
+      std::unique_lock<std::mutex> lock(_mtx_export);
+      while (!_cv_export.wait_for(lock, interval, [this]() { return !_exporting; })) {
+	_write_stats(_export_path);
+      }
+    });
+}
+
+bool XMAirLevelTester::_write_stats(const std::string& path) const
+{
+  // Write to a temporary file first so readers never see a partial file
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::trunc);
+    out << stats_json();
+    if (!out) {
+      return false;
+    }
+  }
+
+  return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+uint64_t XMAirLevelTester::_send(const lo::Address& mixer_addr, const std::string& path)
+{
+  return _send(mixer_addr, path, lo::Message());
+}
+
+uint64_t XMAirLevelTester::_send(const lo::Address& mixer_addr, const std::string& path, float value)
+{
+  lo::Message msg;
+  msg.add_float(value);
+  return _send(mixer_addr, path, msg);
+}
+
+uint64_t XMAirLevelTester::_send(const lo::Address& mixer_addr, const std::string& path, const char* value)
+{
+  lo::Message msg;
+  msg.add_string(value);
+  return _send(mixer_addr, path, msg);
+}
+
+uint64_t XMAirLevelTester::_send(const lo::Address& mixer_addr, const std::string& path, const lo::Message& msg)
+{
+  return _batcher.add(mixer_addr, path, msg);
+}
+
+void XMAirLevelTester::_pace(uint messages)
+{
+  auto start = AdaptivePacer::Clock::now();
+  _pacer.pace(messages);
+  _send_wait.record(AdaptivePacer::Clock::now() - start);
+}
+
+bool XMAirLevelTester::start_capture(const std::string& path)
+{
+  if (_recorder_storage) {
+    return false; // Only one capture per tester
+  }
+
+  try {
+    _recorder_storage.reset(new OscRecorder(path));
+  } catch (const std::runtime_error& e) {
+    std::cout << e.what() << std::endl;
+    return false;
+  }
+  _recorder = _recorder_storage.get();
+
+  return true;
+}
+
+void XMAirLevelTester::stop_capture()
+{
+  // The recorder is kept since the server thread might still be using it
+  _recorder = nullptr;
+  if (_recorder_storage) {
+    _recorder_storage->flush();
+  }
+}
+
+int XMAirLevelTester::dispatch(void* data, size_t size)
+{
+  if (_receiver) {
+    return _receiver->dispatch(static_cast<const char*>(data), size);
+  }
+  return _lo_server.dispatch_data(data, size);
+}
+
+ReplyCorrelator::Ticket XMAirLevelTester::expect(std::string_view path, bool node)
+{
+  const FaderState* fader = _fader(path);
+  if (!fader) {
+    return ReplyCorrelator::Ticket{0, ReplyCorrelator::Ticket::INVALID};
+  }
+  std::lock_guard<std::mutex> lock(_mtx_send);
+  return _correlator.issue(fader->key, node ? NODE_REPLY : FLOAT_REPLY);
+}
+
+bool XMAirLevelTester::collect(const ReplyCorrelator::Ticket& ticket, ReplyCorrelator::Reply& reply)
+{
+  return _correlator.wait(ticket, reply, ReplyCorrelator::Clock::now());
+}
+
+AdaptivePacer::Stats XMAirLevelTester::pacer_stats() const
+{
+  return _pacer.stats();
+}
+
+uint64_t XMAirLevelTester::retransmissions() const
+{
+  return _retransmissions;
+}
+
+bool XMAirLevelTester::_query(const lo::Address& mixer_addr, const FaderState& fader,
+			      ReplyKind kind, ReplyCorrelator::Reply& reply)
+{
+  for (uint attempt = 0; attempt <= MAX_RETRIES; ++attempt) {
+    _pace();
+    auto sent = ReplyCorrelator::Clock::now();
+    auto ticket = _send_query(mixer_addr, fader, kind);
+    if (_correlator.wait(ticket, reply, sent + _pacer.timeout())) {
+      // A reply to a retransmission might be the late one to an earlier
+      // attempt, so it's no RTT sample.
+      if (attempt == 0) {
+	_pacer.on_reply(reply.received - sent);
+	_rtt[kind].record(reply.received - sent);
+      } else {
+	_pacer.on_reply();
+      }
+      return true;
+    }
+    _pacer.on_loss();
+    if (attempt < MAX_RETRIES) {
+      ++_retransmissions;
+    }
+  }
+
+  return false;
+}
+
+const XMAirLevelTester::FaderState* XMAirLevelTester::_fader(std::string_view path) const
+{
+  for (const auto& fader : _faders) {
+    if (fader.path == path) {
+      return &fader;
+    }
+  }
+  return nullptr;
+}
 
-  if (std::regex_match(node_reply, match, fader_regex) ) {
-     std::ssub_match sub_match = match[3];
-     std::string db_string = sub_match.str();
-     std::promise<std::string> promise_tmp;
-     std::swap(promise_tmp, _promise_fader_db);
-     promise_tmp.set_value(db_string);
+AsyncTask<float> XMAirLevelTester::query_float(const lo::Address& mixer_addr, std::string path,
+					       std::stop_token stop)
+{
+  ReplyCorrelator::Reply reply;
+  bool ready = co_await _query_async(mixer_addr, _fader(path), FLOAT_REPLY, reply, stop);
+
+  co_return ready ? reply.f : -1.0f;
+}
+
+AsyncTask<std::string> XMAirLevelTester::query_db(const lo::Address& mixer_addr, std::string path,
+						  std::stop_token stop)
+{
+  ReplyCorrelator::Reply reply;
+  bool ready = co_await _query_async(mixer_addr, _fader(path), NODE_REPLY, reply, stop);
+
+  co_return ready ? std::string(reply.str()) : "TIMEOUT";
+}
+
+AsyncTask<void> XMAirLevelTester::set_float(const lo::Address& mixer_addr, std::string path, float flevel)
+{
+  auto start = AdaptivePacer::Clock::now();
+  co_await AsyncLoop::sleep_until(_pacer.reserve());
+  _send_wait.record(AdaptivePacer::Clock::now() - start);
+  _send(mixer_addr, path, flevel);
+  _batcher.flush();
+}
+
+AsyncTask<int> XMAirLevelTester::check_level(const lo::Address& mixer_addr, std::string path, float flevel,
+					     std::stop_token stop)
+{
+  co_await set_float(mixer_addr, path, flevel);
+  float fader_float = co_await query_float(mixer_addr, path, stop);
+  std::string node_db = co_await query_db(mixer_addr, path, stop);
+
+  co_return evaluate_step(StepResult{0, flevel, fader_float, node_db}, false);
+}
+
+AsyncTask<bool> XMAirLevelTester::_query_async(const lo::Address& mixer_addr, const FaderState* fader,
+					       ReplyKind kind, ReplyCorrelator::Reply& reply,
+					       std::stop_token stop)
+{
+  if (!fader) {
+    co_return false; // Replies are only routed for the faders under test
   }
 
+  // Like _query(), but the waits suspend the task instead of blocking.
+  for (uint attempt = 0; attempt <= MAX_RETRIES; ++attempt) {
+    auto start = AdaptivePacer::Clock::now();
+    co_await AsyncLoop::sleep_until(_pacer.reserve());
+    _send_wait.record(AdaptivePacer::Clock::now() - start);
+    if (stop.stop_requested()) {
+      co_return false;
+    }
+
+    auto sent = ReplyCorrelator::Clock::now();
+    auto ticket = _send_query(mixer_addr, *fader, kind);
+    // Not awaited in the condition itself, GCC 12 miscompiles co_await there.
+    bool ready = co_await AsyncReply(_correlator, ticket, reply, sent + _pacer.timeout(), stop);
+    if (ready) {
+      if (attempt == 0) {
+	_pacer.on_reply(reply.received - sent);
+	_rtt[kind].record(reply.received - sent);
+      } else {
+	_pacer.on_reply();
+      }
+      co_return true;
+    }
+    if (stop.stop_requested()) {
+      co_return false; // Cancelled, not lost
+    }
+    _pacer.on_loss();
+    if (attempt < MAX_RETRIES) {
+      ++_retransmissions;
+    }
+  }
+
+  co_return false;
+}
+
+void XMAirLevelTester::_retransmit_step(const lo::Address& mixer_addr, size_t f, StepResult& result,
+					bool have_float, bool have_node)
+{
+  // The fader has moved on in the meantime, so the step's level is sent again
+  // along with the missing queries.
+  const auto& fader = _faders[f];
+  for (uint attempt = 0; attempt < MAX_RETRIES && !(have_float && have_node); ++attempt) {
+    ReplyCorrelator::Ticket float_ticket{fader.key, ReplyCorrelator::Ticket::INVALID};
+    ReplyCorrelator::Ticket node_ticket = float_ticket;
+    _pace(1 + !have_float + !have_node);
+    {
+      std::lock_guard<std::mutex> lock(_mtx_send);
+      _send(mixer_addr, fader.path, result.flevel);
+      if (!have_float) {
+	float_ticket = _correlator.issue(fader.key, FLOAT_REPLY);
+	_send(mixer_addr, fader.path);
+      }
+      if (!have_node) {
+	node_ticket = _correlator.issue(fader.key, NODE_REPLY);
+	_send(mixer_addr, "/node", fader.node_query.c_str());
+      }
+      _batcher.flush();
+    }
+    ++_retransmissions;
+
+    auto deadline = ReplyCorrelator::Clock::now() + _pacer.timeout();
+    ReplyCorrelator::Reply reply;
+    if (!have_float) {
+      have_float = _correlator.wait(float_ticket, reply, deadline);
+      if (have_float) {
+	result.fader_float = reply.f;
+      }
+    }
+    if (!have_node) {
+      have_node = _correlator.wait(node_ticket, reply, deadline);
+      if (have_node) {
+	result.node_db = reply.str();
+      }
+    }
+    if (have_float && have_node) {
+      _pacer.on_reply();
+    } else {
+      _pacer.on_loss();
+    }
+  }
+}
+
+ReplyCorrelator::Ticket XMAirLevelTester::_send_query(const lo::Address& mixer_addr,
+						      const FaderState& fader, ReplyKind kind)
+{
+  std::lock_guard<std::mutex> lock(_mtx_send);
+  auto ticket = _correlator.issue(fader.key, kind);
+  if (kind == FLOAT_REPLY) {
+    _send(mixer_addr, fader.path);
+  } else {
+    _send(mixer_addr, "/node", fader.node_query.c_str());
+  }
+  _batcher.flush(); // The caller waits for the reply right away
+  return ticket;
+}
+
+int XMAirLevelTester::_fader_float_handler(size_t fader, const lo::Message &msg)
+{
+  _fader_float_reply(fader, msg.argv()[0]->f);
   return 1;
 }
 
-int XMAirLevelTester::_info_handler(const char *path, const lo::Message &msg)
+int XMAirLevelTester::_fader_db_handler(const char* path, const lo::Message &msg)
 {
-  // Use a lock guard to keep this code from being called concurrently
-  std::lock_guard<std::mutex> lock(_mtx_info);
-  std::cout << "Found X Air device"
-  	    << "\nName: " << &msg.argv()[1]->s
-  	    << "\nModel: " << &msg.argv()[2]->s
-  	    << "\nRev.: " <<  &msg.argv()[0]->s
-  	    << "\nFirmware: " << &msg.argv()[3]->s
-  	    << "\n" << std::endl;
+  // As a reply to our node query we  expect messages from the mixer on path "node"
+  // of the form "/ch/12/mix/fader -10.0". The last part is the "Node" dB value as
+  // a string. The dispatcher hands it to the handler registered for the path.
+  _node_dispatcher.dispatch(&msg.argv()[0]->s);
 
-  // In case this method is called repeatedly
-  // we need another promise:
-  std::promise<lo::Address*> promise_tmp;
-  std::swap(promise_tmp, _promise_mixer_addr);
+  return 1;
+}
 
-  // Somehow we can't use a lo::Address directly as a promise value.
-  // Work aroudn with a shared_ptr.
-  //TODO: Find out why?
-  auto mixer_ptr = new lo::Address(msg.source().url());
-  promise_tmp.set_value(mixer_ptr);
+void XMAirLevelTester::_fader_float_reply(size_t fader, float f)
+{
+  _correlator.complete(_faders[fader].key, FLOAT_REPLY, f, std::string_view());
+}
 
-  return 0;
+void XMAirLevelTester::_fader_db_reply(size_t fader, std::string_view db)
+{
+  _correlator.complete(_faders[fader].key, NODE_REPLY, -1.0f, db);
 }
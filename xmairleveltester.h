@@ -22,43 +22,164 @@
 #define XMAIRLEVELTESTER_H
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
-#include <future>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 #include <lo/lo_cpp.h>
 
+#include "adaptivepacer.h"
+#include "asyncloop.h"
+#include "goldentable.h"
+#include "latencyhistogram.h"
+#include "oscbatcher.h"
+#include "oscreceiver.h"
+#include "oscrecorder.h"
+#include "replycorrelator.h"
+#include "resultsink.h"
 #include "xrm32level.hpp"
+#include "xrm32node.hpp"
 
 class XMAirLevelTester {
 public:
+    /**
+     * @brief Outcome of a single sweep step as received from the mixer.
+     */
+    struct StepResult {
+      uint step;             // Step number within the sweep
+      float flevel;          // Float level that has been sent
+      float fader_float;     // Float level reported by the mixer, -1.f on timeout
+      std::string node_db;   // dB string reported via /node, "TIMEOUT" on timeout
+      std::chrono::steady_clock::duration latency{};  // From sending the step to its last reply
+    };
+
+    /**
+     * @brief The console's /node dB string for every fader index, see map_node_db().
+     */
+    struct NodeDbMap {
+      std::vector<std::string> node_db;   // dB string per index, "TIMEOUT" if unknown
+      uint distinct;                      // Number of distinct dB strings
+      uint probes;                        // Indices set and queried on the mixer
+      uint rounds;                        // Sweeps run
+      std::vector<uint> unpredicted;      // Indices i where the string changes from i - 1
+                                          // to i although Xrm32Level predicts it doesn't,
+                                          // or vice versa
+    };
+
     /**
      * @brief XMAirLevelTester
      * @param channel The channel whose controls the tests are going to use.
      */
     XMAirLevelTester(uint channel);
+
+    /**
+     * @brief How replies are received.
+     */
+    enum Receiver {
+      LIBLO_RECEIVER,    // liblo's server thread
+      BATCH_RECEIVER     // OscReceiver: recvmmsg() and in-place decoding
+    };
+
+    /**
+     * @brief XMAirLevelTester
+     * @param fader_paths The faders to test, e.g. "/ch/01/mix/fader", "/bus/1/mix/fader"
+     *        or "/dca/1/fader". Sweeps test all of them concurrently, the single fader
+     *        methods use the first one.
+     * @param receiver How replies are received. Both hand them to the same handlers.
+     */
+    XMAirLevelTester(const std::vector<std::string>& fader_paths, Receiver receiver = LIBLO_RECEIVER);
     ~XMAirLevelTester();
 
     /**
-     * @brief run_tests Start testing the fader levels of specified channel.
+     * @brief channel_fader_path Build the fader path of a channel.
+     * @param channel Channel number.
+     * @return Fader path, e.g. "/ch/01/mix/fader".
+     */
+    static std::string channel_fader_path(uint channel);
+
+    /**
+     * @brief fader_paths The faders under test.
+     */
+    std::vector<std::string> fader_paths() const;
+
+    /**
+     * @brief run_tests Start testing the fader levels of all faders under test.
      * @param mixer_addr Mixer address used for testing.
      * @param num_steps Number of equidistant test levels.
+     * @param log Wether test details should be logged.
+     * @param window Number of steps kept in flight. 0 runs the serial test,
+     *        one step after another on the first fader only,
+     *        see check_fader_level().
+     */
+    void run_tests(const lo::Address& mixer_addr, uint num_steps, bool log, uint window = 0);
+
+    /**
+     * @brief sweep Pipelined sweep of all faders under test. The faders' steps are
+     *        interleaved and up to 'window' of them (a set, a float query and a /node
+     *        query each) are in flight. Replies are routed by path and matched back to
+     *        their step by arrival order since the mixer answers in the order it receives.
+     * @param mixer_addr The mixer to use.
+     * @param num_steps Number of equidistant test levels.
+     * @param window Maximum number of steps in flight, at least 1.
+     * @return Results per fader in the order of fader_paths(), each in step order.
+     *         Steps with lost replies are retransmitted a few times, if they still fail
+     *         they keep their timeout values.
      */
-    void run_tests(const lo::Address& mixer_addr, uint num_steps, bool log);
+    std::vector<std::vector<StepResult>> sweep(const lo::Address& mixer_addr, uint num_steps, uint window);
 
     /**
-     * @brief stop Stop the test.
+     * @brief sweep Pipelined sweep of all faders under test over arbitrary levels.
+     * @param mixer_addr The mixer to use.
+     * @param flevels The float levels to test, in this order.
+     * @param window Maximum number of steps in flight, at least 1.
+     * @return Results per fader like the equidistant sweep.
+     */
+    std::vector<std::vector<StepResult>> sweep(const lo::Address& mixer_addr, const std::vector<float>& flevels,
+					       uint window);
+
+    /**
+     * @brief record_golden Store the console's replies in a golden table, keyed by the
+     *        level that has been sent. Steps with lost replies and levels that aren't
+     *        one of the table's steps are skipped.
+     * @return Number of results stored.
+     */
+    static uint record_golden(const std::vector<StepResult>& results, GoldenTable& table);
+
+    /**
+     * @brief verify_golden Compare a Xrm32Level set to each measured step's level to
+     *        the console's replies stored in a golden table instead of the mixer's.
+     *        Doesn't touch the network.
+     * @param table The table to check against.
+     * @param log Wether every step should be logged, not just the mismatches.
+     * @return Number of mismatching steps.
+     */
+    int verify_golden(const GoldenTable& table, bool log);
+
+    /**
+     * @brief report Evaluate and print sweep results, e.g. those of sweeps run in
+     *        parallel against several mixers.
+     * @param results Results per fader as returned by sweep().
+     * @param log Wether every step should be logged, not just the mismatches.
+     */
+    void report(const std::vector<std::vector<StepResult>>& results, bool log);
+
+    /**
+     * @brief stop Stop the test. Writes the final statistics if they are being exported.
      */
      void stop();
 
      /**
-      * @brief Find a suitable mixer in the network. Currently only X/M Air mixers
-      *        are being used. This is a simplistic method that might crash
-      *        whenever there's more than one mixer on the network!
-      * @return Returns a pointer to a lo:Address or nullptr if none is found.
+      * @brief set_result_sink Stream a record of every evaluated step to a sink instead
+      *        of logging it to the console. Summaries and mismatches are still printed.
+      * @param sink The sink, nullptr to log to the console again. Has to outlive the
+      *        tester or be detached first.
       */
-     lo::Address* find_mixer(); // Search for a mixer console
+     void set_result_sink(ResultSink* sink);
 
      /**
       * @brief check_fader_level Sets the tester channel's fader and a Xrm32Level to 'level'. Afterwards compares
@@ -72,20 +193,111 @@ public:
      int check_fader_level(const lo::Address& mixer_addr, float flevel, bool log = true); // Test a level
 
      /**
-      * @brief Count distinct Node fader values
+      * @brief evaluate_step Compares a received step result to a Xrm32Level set to the same level.
+      * @param result The step result to check.
+      * @param log Wether test details should be logged.
+      * @return Returns the same bitfield as check_fader_level().
+      */
+     int evaluate_step(const StepResult& result, bool log = true);
+
+     /**
+      * @brief map_node_db Find the console's dB string for every index of the first fader
+      *        without querying all of them. The strings are ordered like the indices,
+      *        so where two indices have the same string all indices between them have it,
+      *        too. The first index of every run of equal strings Xrm32Level predicts is
+      *        queried first. A range between two queried indices is filled in if its ends
+      *        agree, or if both match the prediction and it holds a single predicted
+      *        transition, at its end. Every other range is bisected until its transitions
+      *        are found. Each probe is just a set and a /node query on the first fader.
       * @param mixer_addr Address of mixer to run the test on.
+      * @param window Probes in flight, see sweep().
       */
-     int count_node_db(const lo::Address& mixer_addr);
+     NodeDbMap map_node_db(const lo::Address& mixer_addr, uint window);
 
+     /**
+      * @brief Count distinct Node fader values with map_node_db() and report the
+      *        transitions Xrm32Level didn't predict.
+      * @param mixer_addr Address of mixer to run the test on.
+      * @param window Steps in flight per sweep, see sweep().
+      */
+     int count_node_db(const lo::Address& mixer_addr, uint window = 16);
+
+
+     /**
+      * @brief start_capture Record every message sent and received from now on with
+      *        timestamps, e.g. for replaying the session with OscReplayer. Only one
+      *        capture per tester.
+      * @param path The file to record to.
+      * @return false if the file can't be written or a capture has been started before.
+      */
+     bool start_capture(const std::string& path);
 
      /**
-      * @brief Set the fader level by float representation.
+      * @brief stop_capture Stop recording and flush the recording.
+      */
+     void stop_capture();
+
+     /**
+      * @brief dispatch Feed a serialised OSC message to the tester's handlers as if it
+      *        had been received, e.g. to benchmark them with a recording. Mustn't be
+      *        called while replies arrive from a mixer.
+      *        Bundles are only taken by the BATCH_RECEIVER.
+      * @return A negative value on error.
+      */
+     int dispatch(void* data, size_t size);
+
+     /**
+      * @brief expect Issue the ticket of a query without sending it, e.g. for a query
+      *        in a recording, so that dispatch() hands its reply over like in a test.
+      * @param path One of fader_paths().
+      * @param node true for a /node query of the fader, false for its float level.
+      * @return Ticket to collect() the reply with, invalid for other paths.
+      */
+     ReplyCorrelator::Ticket expect(std::string_view path, bool node);
+
+     /**
+      * @brief collect Collect the reply to an expect()ed query without waiting.
+      * @return false if no reply has been dispatched for it.
+      */
+     bool collect(const ReplyCorrelator::Ticket& ticket, ReplyCorrelator::Reply& reply);
+
+     /**
+      * @brief pacer_stats Send rate and RTT estimate of the link to the mixer.
+      */
+     AdaptivePacer::Stats pacer_stats() const;
+
+     /**
+      * @brief retransmissions Number of queries sent again after their reply got lost.
+      */
+     uint64_t retransmissions() const;
+
+     /**
+      * @brief stats_json Latency histograms per message type (p50/p90/p99/max in
+      *        microseconds), counts of timeouts, retransmissions, out of order and
+      *        unmatched replies, the link's pacing state, the number of messages
+      *        and datagrams sent and, with the BATCH_RECEIVER, its counters as a
+      *        JSON object.
+      */
+     std::string stats_json() const;
+
+     /**
+      * @brief export_stats Write stats_json() to a file periodically and once more
+      *        when the tester is stopped. The file is replaced atomically.
+      * @param path The file to write.
+      * @param interval Time between writes.
+      */
+     void export_stats(const std::string& path, std::chrono::milliseconds interval);
+
+     /**
+      * @brief Set the fader level by float representation. Sends are paced to the
+      *        rate the mixer sustains.
       * @param flevel The feder float level.
       */
      void set_fader_float(const lo::Address& mixer_addr, float flevel);
 
      /**
-      * @brief Query the current float representation of the fader.
+      * @brief Query the current float representation of the fader. Lost queries are
+      *        retransmitted after a timeout derived from the measured RTT.
       * @return Current fader level (float) or -1.f in case of error.
       */
      float query_fader_float(const lo::Address& mixer_addr);
@@ -98,27 +310,118 @@ public:
      void set_fader_db(const lo::Address& mixer_addr, std::string db);
 
      /**
-      * @brief Query the current dB string representation of the fader.
+      * @brief Query the current dB string representation of the fader. Lost queries
+      *        are retransmitted like in query_fader_float().
       * @return Current fader level (dB) as string
       */
      std::string query_fader_db(const lo::Address& mixer_addr);
 
+     /**
+      * @brief Asynchronous query of the float level of a fader under test. Runs on an
+      *        AsyncLoop, so any number of them can be in flight on the loop's thread.
+      *        Sends are paced and lost queries retransmitted like in query_fader_float().
+      * @param mixer_addr The mixer to use. Has to outlive the task.
+      * @param path One of fader_paths().
+      * @param stop Cancels the query.
+      * @return Current fader level (float) or -1.f on error, timeout or cancellation.
+      */
+     AsyncTask<float> query_float(const lo::Address& mixer_addr, std::string path,
+				  std::stop_token stop = {});
+
+     /**
+      * @brief Asynchronous query of the dB string of a fader under test, see query_float().
+      * @return Current fader level (dB) as string or "TIMEOUT".
+      */
+     AsyncTask<std::string> query_db(const lo::Address& mixer_addr, std::string path,
+				     std::stop_token stop = {});
+
+     /**
+      * @brief Asynchronously set the float level of a fader under test. Returns once
+      *        the pacer allowed sending it.
+      */
+     AsyncTask<void> set_float(const lo::Address& mixer_addr, std::string path, float flevel);
+
+     /**
+      * @brief Asynchronous check_fader_level() of a fader under test, without logging.
+      * @return The same bitfield as check_fader_level().
+      */
+     AsyncTask<int> check_level(const lo::Address& mixer_addr, std::string path, float flevel,
+				std::stop_token stop = {});
+
 private:
     uint _num_steps; // Number of steps to test
     uint _step = 0;
-    uint _channel; // channel number to use for testing
-    std::promise<lo::Address*> _promise_mixer_addr;
-    std::promise<float> _promise_fader_level;
-    std::promise<std::string> _promise_fader_db;
-    lo::Address _broadcast_addr;
-    lo::Message _xinfo_msg;
     lo::ServerThread _lo_server;
-    std::string _fader_level_path, _fader_db_node_msg;
     std::string _fader_level_types, _fader_db_types;
-    int _info_handler(const char* path, const lo::Message &msg);
-    int _fader_float_handler(const char* path, const lo::Message &msg);
+    std::unique_ptr<OscReceiver> _receiver;   // Reads _lo_server's socket instead of liblo
+    int _fader_float_handler(size_t fader, const lo::Message &msg);
     int _fader_db_handler(const char* path, const lo::Message &msg);
-    std::mutex _mtx_info, _mtx_fader_float, _mtx_fader_db, _mtx_db;
+    void _fader_float_reply(size_t fader, float f);
+    void _fader_db_reply(size_t fader, std::string_view db);
+    Xrm32::NodeDispatcher _node_dispatcher;
+
+    // Kinds of replies we correlate with their requests
+    enum ReplyKind : uint { FLOAT_REPLY, NODE_REPLY };
+
+    // A fader under test
+    struct FaderState {
+      std::string path;         // e.g. "/ch/13/mix/fader"
+      std::string node_query;   // e.g. "ch/13/mix/fader"
+      size_t key;               // Correlator key for float and /node replies
+    };
+    std::vector<FaderState> _faders;
+
+    // Replies are handed over by the server thread through the correlator.
+    // Issuing a request and sending it happen under _mtx_send so that requests
+    // leave in the order they have been issued.
+    ReplyCorrelator _correlator;
+    std::mutex _mtx_send;
+    ReplyCorrelator::Ticket _send_query(const lo::Address& mixer_addr, const FaderState& fader, ReplyKind kind);
+
+    // Paces all sends and provides the timeouts for retransmissions
+    AdaptivePacer _pacer;
+    std::atomic<uint64_t> _retransmissions{0};
+    void _pace(uint messages = 1);
+
+    // Every message to the mixer is sent through these. They are bundled, callers
+    // about to wait for a reply have to flush the batcher first. Each returns the
+    // message's sequence number in the batcher.
+    uint64_t _send(const lo::Address& mixer_addr, const std::string& path);
+    uint64_t _send(const lo::Address& mixer_addr, const std::string& path, float value);
+    uint64_t _send(const lo::Address& mixer_addr, const std::string& path, const char* value);
+    uint64_t _send(const lo::Address& mixer_addr, const std::string& path, const lo::Message& msg);
+    OscBatcher _batcher;
+    std::unique_ptr<OscRecorder> _recorder_storage;
+    std::atomic<OscRecorder*> _recorder{nullptr};
+    bool _query(const lo::Address& mixer_addr, const FaderState& fader, ReplyKind kind,
+		ReplyCorrelator::Reply& reply);
+    void _retransmit_step(const lo::Address& mixer_addr, size_t fader, StepResult& result,
+			  bool have_float, bool have_node);
+    const FaderState* _fader(std::string_view path) const;
+    AsyncTask<bool> _query_async(const lo::Address& mixer_addr, const FaderState* fader,
+				 ReplyKind kind, ReplyCorrelator::Reply& reply, std::stop_token stop);
+
+    // Instrumentation. Sets aren't acknowledged by the mixer, what they cost is
+    // the time spent waiting for the pacer, recorded for every send.
+    LatencyHistogram _send_wait;
+    LatencyHistogram _rtt[2];   // Round trip times per ReplyKind
+    std::string _export_path;
+    std::thread _exporter;
+    bool _exporting = false;
+    std::mutex _mtx_export;
+    std::condition_variable _cv_export;
+    bool _write_stats(const std::string& path) const;
+
+    // Per-step results go here if set
+    std::atomic<ResultSink*> _sink{nullptr};
+    int _evaluate(size_t fader, const StepResult& result, bool log);
+
+    // Pipelined set and /node query of the first fader for each index, see map_node_db()
+    std::vector<std::string> _probe_node_db(const lo::Address& mixer_addr, const std::vector<uint>& indices,
+					    uint window);
+
+    // Serial sweep of the first fader, one step after another
+    std::vector<StepResult> _serial_sweep(const lo::Address& mixer_addr, uint num_steps);
 };
 
 #endif // XMAIRLEVELTESTER_H
@@ -0,0 +1,194 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <deque>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "oscrecorder.h"
+#include "oscreplayer.h"
+#include "xmairleveltester.h"
+
+using namespace std::literals;
+
+static std::atomic<bool> running{true};
+
+static void usage(const char* name)
+{
+  std::cout << "Usage: " << name << " RECORDING [options]"
+	    << "\n  --port N        UDP port to listen on as the mixer (default 10024)"
+	    << "\n  --speed S       Factor applied to recorded delays, 0 for as fast as possible (default 1)"
+	    << "\n  --bench N       Don't listen, feed the recorded replies N times into the"
+	    << "\n                  tester's handlers and report the rate"
+	    << "\n  --receiver R    Decoder used by --bench: liblo or batch (default liblo)"
+	    << std::endl;
+}
+
+/**
+ * @brief bench Run the tester's reply handling on a recording without any network.
+ *        The recorded queries are expected by the tester in the recorded order, so
+ *        their replies are handed over to outstanding requests like in a test.
+ */
+static int bench(const std::vector<OscRecorder::Record>& records, uint repetitions,
+		 XMAirLevelTester::Receiver receiver)
+{
+  // What to do for each record: expect a query's reply or dispatch a reply
+  struct Step {
+    std::string fader;      // Empty to dispatch the reply
+    bool node;
+    const OscRecorder::Record* reply;
+  };
+  std::vector<Step> steps;
+  std::set<std::string> faders;
+  uint64_t num_replies = 0;
+  for (const auto& record : records) {
+    std::string path = lo_get_path(const_cast<char*>(record.data.data()), record.data.size());
+    if (record.direction == OscRecorder::RECEIVED) {
+      steps.push_back(Step{"", false, &record});
+      ++num_replies;
+      continue;
+    }
+    lo::Message msg = lo::Message::deserialise(const_cast<char*>(record.data.data()), record.data.size());
+    if (path == "/node" && msg.types() == "s") {
+      steps.push_back(Step{"/" + std::string(&msg.argv()[0]->s), true, nullptr});
+    } else if (path.find("fader") != std::string::npos) {
+      // Test the faders that have been tested in the recording
+      faders.insert(path);
+      if (msg.argc() == 0) {
+	steps.push_back(Step{path, false, nullptr});
+      }
+    }
+  }
+  if (faders.empty() || num_replies == 0) {
+    std::cout << "Nothing to replay!" << std::endl;
+    return -1;
+  }
+
+  // Replies are collected once they're long in, well within the correlator's slots.
+  const size_t max_outstanding = 64;
+  XMAirLevelTester tester(std::vector<std::string>(faders.begin(), faders.end()), receiver);
+  std::deque<ReplyCorrelator::Ticket> outstanding;
+  ReplyCorrelator::Reply reply;
+  uint64_t matched = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint r = 0; r < repetitions; ++r) {
+    for (const auto& step : steps) {
+      if (step.reply) {
+	tester.dispatch(const_cast<char*>(step.reply->data.data()), step.reply->data.size());
+      } else {
+	auto ticket = tester.expect(step.fader, step.node);
+	if (ticket.valid()) {
+	  outstanding.push_back(ticket);
+	}
+      }
+      if (outstanding.size() > max_outstanding) {
+	matched += tester.collect(outstanding.front(), reply);
+	outstanding.pop_front();
+      }
+    }
+  }
+  while (!outstanding.empty()) {
+    matched += tester.collect(outstanding.front(), reply);
+    outstanding.pop_front();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  uint64_t messages = num_replies * repetitions;
+  std::cout << "Dispatched " << messages << " replies in " << elapsed.count() << " s: "
+	    << messages / elapsed.count() << " replies/s, "
+	    << elapsed.count() * 1e9 / messages << " ns/reply, "
+	    << matched << " matched a request" << std::endl;
+
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2 || std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h") {
+    usage(argv[0]);
+    return argc < 2 ? -1 : 0;
+  }
+
+  OscReplayer::Config config;
+  uint repetitions = 0;
+  auto receiver = XMAirLevelTester::LIBLO_RECEIVER;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return -1;
+    }
+    std::string val = argv[++i];
+    if (arg == "--port") {
+      config.port = std::stoi(val);
+    } else if (arg == "--speed") {
+      config.speed = std::stod(val);
+    } else if (arg == "--bench") {
+      repetitions = std::stoul(val);
+    } else if (arg == "--receiver" && (val == "liblo" || val == "batch")) {
+      receiver = val == "batch" ? XMAirLevelTester::BATCH_RECEIVER : XMAirLevelTester::LIBLO_RECEIVER;
+    } else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  std::vector<OscRecorder::Record> records;
+  try {
+    records = OscRecorder::load(argv[1]);
+  } catch (const std::runtime_error& e) {
+    std::cout << e.what() << std::endl;
+    return -1;
+  }
+  std::cout << "Loaded " << records.size() << " messages." << std::endl;
+
+  if (repetitions > 0) {
+    return bench(records, repetitions, receiver);
+  }
+
+  OscReplayer replayer(records, config);
+  if (!replayer.is_valid()) {
+    std::cout << "Could not listen on port " << config.port << "!" << std::endl;
+    return -1;
+  }
+
+  std::signal(SIGINT, [](int) { running = false; });
+  std::signal(SIGTERM, [](int) { running = false; });
+
+  replayer.start();
+  std::cout << "Replaying " << argv[1] << " at " << replayer.url() << std::endl;
+
+  while (running && !replayer.wait(100ms)) {
+  }
+  replayer.stop();
+
+  auto stats = replayer.stats();
+  std::cout << "\nRequests: " << stats.requests
+	    << "\nReplies: " << stats.replies
+	    << "\nNot replayed: " << stats.pending << std::endl;
+
+  return 0;
+}
@@ -16,11 +16,196 @@
 
 #pragma once
 #include <atomic>
+#include <cctype>
+#include <charconv>
 #include <cmath>
+#include <cstring>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
 
 namespace Xrm32 {
 
+/**
+ * @brief Compile-time lookup tables for Level<N>. For each of the N indices they hold
+ *        the dB value and the OSC dB string, computed with exactly the same float
+ *        arithmetic a Level<N> used to do at runtime. For parsing, every OSC string in
+ *        canonical console format from "-90.0" to "+10.0" maps directly to its index.
+ */
+template<uint N>
+struct LevelTables {
+    static_assert(N > 0, "Template parameter N has to be greater than 0!");
+
+    // N - 1, the divisor of the conversions. A single step level only has index 0,
+    // float level 0 and -oo, so there's nothing to divide and 1 avoids dividing by 0.
+    static constexpr uint DIVISOR = N > 1 ? N - 1 : 1;
+
+    // Room for the longest in-range OSC string, e.g. "-89.5", plus terminator.
+    static constexpr uint OSC_STRING_SIZE = 8;
+
+    // Range of canonical OSC strings in tenths of a dB
+    static constexpr int OSC_KEY_MIN = -900;
+    static constexpr int OSC_KEY_MAX = 100;
+
+    /**
+     * @brief dbFromIndex Conversion according to Behringer.
+     * @param idx Level index.
+     * @return dB value.
+     */
+    static constexpr float dbFromIndex(uint idx)
+    {
+        float db = -144.f;
+
+        if (N == 1 && idx == 0) {
+            return db;
+        }
+        if (idx >= N / 2) {
+	  db = (40.f * idx) / DIVISOR - 30;
+        } else if (idx >= N / 4) {
+	  db = (80.f * idx) / DIVISOR - 50;
+        } else if (idx >= N / 16) {
+	  db = (160.f * idx) / DIVISOR - 70;
+        } else if ( idx > 0) {
+	  db = (480.f * idx) / DIVISOR - 90;
+        }
+
+        return db;
+    }
+
+    /**
+     * @brief formatOscString Write the OSC string for a dB value, e.g. "-10.4", "+2.0",
+     *        "0.0" or "-oo". The output is null terminated.
+     * @param dB dB value as returned by dbFromIndex().
+     * @param out Output buffer. Needs to hold at least 14 chars for arbitrary dB values,
+     *        OSC_STRING_SIZE for those of valid indices.
+     * @return Length of the string without terminator.
+     */
+    static constexpr uint formatOscString(float dB, char* out)
+    {
+        uint len = 0;
+        if (dB == -144.f) {
+	  out[len++] = '-';
+	  out[len++] = 'o';
+	  out[len++] = 'o';
+        } else {
+	  char sign = dB < 0 ? '-' : '+';
+	  if (dB < 0) {
+	    dB = -dB;
+	  }
+	  float rounded = static_cast<int>(10 * dB + 0.5f) * 0.1f;
+	  int dbInt = static_cast<int>(rounded);
+	  int fractional = 10 * rounded - 10 * static_cast<int>(rounded);
+	  if (dbInt != 0 || fractional != 0) {
+	    out[len++] = sign;
+	  }
+	  char digits[10] = {};
+	  uint num_digits = 0;
+	  do {
+	    digits[num_digits++] = static_cast<char>('0' + dbInt % 10);
+	    dbInt /= 10;
+	  } while (dbInt > 0);
+	  while (num_digits > 0) {
+	    out[len++] = digits[--num_digits];
+	  }
+	  out[len++] = '.';
+	  out[len++] = static_cast<char>('0' + fractional);
+        }
+        out[len] = '\0';
+        return len;
+    }
+
+    /**
+     * @brief indexFromDb Conversion from dB to index.
+     * @param db A level's dB value
+     * @return Index of dB value
+     */
+    static constexpr uint indexFromDb(float db)
+    {
+        float level = 0;
+        if (db >= (40.f * N) / (2 * DIVISOR) - 30) {
+            level = (db + 30) / 40;
+        } else if (db >= (80.f * N) / (4 * DIVISOR) - 50) {
+            level = (db + 50) / 80;
+        } else if (db >= (160.f * N) / (16 * DIVISOR) - 70) {
+            level = (db + 70) / 160;
+        } else if (db > -90) {
+            level = (db + 90) / 480;
+        } else { // db <= -90, idx = 0;
+            level = 0;
+        }
+
+        uint idx = (uint)(level * (N - 1 + 0.5f));
+        return idx;
+    }
+
+    /**
+     * @brief oscKey Map an OSC string in exactly the format formatOscString() produces
+     *        to its value in tenths of a dB. This is injective, so it serves as a
+     *        perfect hash into osc_index.
+     * @param val OSC string, e.g. "-10.4".
+     * @param key Value in tenths of a dB, e.g. -104.
+     * @return false if val isn't canonical or out of [OSC_KEY_MIN, OSC_KEY_MAX].
+     */
+    static constexpr bool oscKey(std::string_view val, int& key)
+    {
+        size_t pos = 0;
+        bool negative = false, has_sign = false;
+        if (pos < val.size() && (val[pos] == '-' || val[pos] == '+')) {
+	  negative = val[pos] == '-';
+	  has_sign = true;
+	  ++pos;
+        }
+
+        // Integer part without leading zeros, at most two digits
+        size_t int_start = pos;
+        int value = 0;
+        while (pos < val.size() && val[pos] >= '0' && val[pos] <= '9') {
+	  value = 10 * value + (val[pos] - '0');
+	  ++pos;
+        }
+        size_t int_digits = pos - int_start;
+        if (int_digits == 0 || int_digits > 2 || (int_digits == 2 && val[int_start] == '0')) {
+	  return false;
+        }
+
+        // Exactly one fractional digit
+        if (pos + 2 != val.size() || val[pos] != '.' || val[pos + 1] < '0' || val[pos + 1] > '9') {
+	  return false;
+        }
+        value = 10 * value + (val[pos + 1] - '0');
+
+        // Zero is the only value without a sign
+        if (has_sign == (value == 0)) {
+	  return false;
+        }
+        key = negative ? -value : value;
+
+        return key >= OSC_KEY_MIN && key <= OSC_KEY_MAX;
+    }
+
+    constexpr LevelTables() : db{}, osc{}, osc_len{}, osc_index{}
+    {
+        for (uint idx = 0; idx < N; ++idx) {
+	  db[idx] = dbFromIndex(idx);
+	  osc_len[idx] = formatOscString(db[idx], osc[idx]);
+        }
+        // key / 10.f is the correctly rounded float of the decimal string,
+        // just like the one a numeric parser yields.
+        for (int key = OSC_KEY_MIN; key <= OSC_KEY_MAX; ++key) {
+	  osc_index[key - OSC_KEY_MIN] = indexFromDb(key / 10.f);
+        }
+    }
+
+    float db[N];
+    char osc[N][OSC_STRING_SIZE];
+    uint osc_len[N];
+    uint osc_index[OSC_KEY_MAX - OSC_KEY_MIN + 1];
+};
+
+template<uint N>
+constexpr LevelTables<N> levelTables{};
+
 template<uint N>
 class Level {
 public:
@@ -31,7 +216,7 @@ public:
         setFloat(level);
     }
 
-    explicit Level(std::string osc_value_string)
+    explicit Level(std::string_view osc_value_string)
     {
         setOscString(osc_value_string);
     }
@@ -56,7 +241,7 @@ public:
      */
     float getFloat() const
     {
-        return static_cast<float>(_idx) / (N - 1);
+        return static_cast<float>(_idx) / LevelTables<N>::DIVISOR;
     }
 
     /**
@@ -65,23 +250,10 @@ public:
      */
     float getDb() const
     {
-        // Conversion according to Behringer
-        float db;
         const uint idx = _idx; // Get a working copy of the atomic value
 
-        if (idx >= N / 2) {
-	  db = (40.f * idx) / (N - 1) - 30;
-        } else if (idx >= N / 4) {
-	  db = (80.f * idx) / (N - 1) - 50;
-        } else if (idx >= N / 16) {
-	  db = (160.f * idx) / (N - 1) - 70;
-        } else if ( idx > 0) {
-	  db = (480.f * idx) / (N - 1) - 90;
-        } else { // _idx == 0
-            db = -144.f;
-        }
-
-        return db;
+        // Indices set via out of range dB values aren't covered by the table.
+        return idx < N ? levelTables<N>.db[idx] : LevelTables<N>::dbFromIndex(idx);
     }
 
     /**
@@ -117,21 +289,120 @@ public:
      */
     static uint indexFromDb(float db)
     {
-        float level;
-        if (db >= (40.f * N) / (2 * (N - 1)) - 30) {
-            level = (db + 30) / 40;
-        } else if (db >= (80.f * N) / (4 * (N - 1)) - 50) {
-            level = (db + 50) / 80;
-        } else if (db >= (160.f * N) / (16 * (N - 1)) - 70) {
-            level = (db + 70) / 160;
-        } else if (db > -90) {
-            level = (db + 90) / 480;
-        } else { // db <= -90, idx = 0;
-            level = 0;
+        return LevelTables<N>::indexFromDb(db);
+    }
+
+    /**
+     * @brief indexFromFloat Batch version of indexFromFloat(float) with bit-identical
+     *        results. Like the other batch conversions it is branch free, so GCC
+     *        vectorizes it at -O3 given -fno-trapping-math (which doesn't alter results).
+     * @param flevels Float levels to convert.
+     * @param indices Output, room for 'count' indices.
+     * @param count Number of values.
+     */
+    static void indexFromFloat(const float* flevels, uint* indices, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+	  float flevel = flevels[i];
+	  flevel = flevel > 1.0f ? 1.0f : flevel;
+	  flevel = flevel <= 0 ? 0 : flevel;
+	  uint idx = _truncate(flevel * (N - 1 + 0.5f));
+	  indices[i] = idx > N - 1 ? N - 1 : idx;
         }
+    }
 
-        uint idx = (uint)(level * (N - 1 + 0.5f));
-        return idx;
+    /**
+     * @brief indexFromDb Batch version of indexFromDb(float) with bit-identical results.
+     * @param dbs dB values to convert.
+     * @param indices Output, room for 'count' indices.
+     * @param count Number of values.
+     */
+    static void indexFromDb(const float* dbs, uint* indices, size_t count)
+    {
+        // Lower bounds of the segments as in LevelTables<N>::indexFromDb()
+        constexpr float min_db_1 = (40.f * N) / (2 * LevelTables<N>::DIVISOR) - 30;
+        constexpr float min_db_2 = (80.f * N) / (4 * LevelTables<N>::DIVISOR) - 50;
+        constexpr float min_db_3 = (160.f * N) / (16 * LevelTables<N>::DIVISOR) - 70;
+
+        for (size_t i = 0; i < count; ++i) {
+	  float db = dbs[i];
+	  // Pick offset and divisor of the segment, from the lowest to the highest
+	  float offset = db >= min_db_3 ? 70.f : 90.f;
+	  float divisor = db >= min_db_3 ? 160.f : 480.f;
+	  offset = db >= min_db_2 ? 50.f : offset;
+	  divisor = db >= min_db_2 ? 80.f : divisor;
+	  offset = db >= min_db_1 ? 30.f : offset;
+	  divisor = db >= min_db_1 ? 40.f : divisor;
+	  float level = (db + offset) / divisor;
+	  level = db > -90 ? level : 0; // Every segment lies above -90 dB
+	  indices[i] = _truncate(level * (N - 1 + 0.5f));
+        }
+    }
+
+    /**
+     * @brief dbFromIndex Batch conversion from indices to dB values, bit-identical to getDb().
+     * @param indices Indices to convert.
+     * @param dbs Output, room for 'count' dB values.
+     * @param count Number of values.
+     */
+    static void dbFromIndex(const uint* indices, float* dbs, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+	  uint idx = indices[i];
+	  // Pick factor and offset of the segment, from the lowest to the highest
+	  float factor = idx >= N / 16 ? 160.f : 480.f;
+	  float offset = idx >= N / 16 ? 70.f : 90.f;
+	  factor = idx >= N / 4 ? 80.f : factor;
+	  offset = idx >= N / 4 ? 50.f : offset;
+	  factor = idx >= N / 2 ? 40.f : factor;
+	  offset = idx >= N / 2 ? 30.f : offset;
+	  float db = (factor * _toFloat(idx)) / LevelTables<N>::DIVISOR - offset;
+	  // Index 0 is -144 dB unless a segment starts at 0, as for 1 < N < 16
+	  dbs[i] = (idx > 0) | (N > 1 && idx >= N / 16) ? db : -144.f;
+        }
+    }
+
+    /**
+     * @brief indexFromOscString Static conversion function from OSC string to index.
+     *        Strings in the console's own format are looked up directly, anything else
+     *        is parsed like std::stof() would and converted by indexFromDb().
+     * @param val Signed dB value as string, e.g. "-10.0" or "+2.0", or "-oo".
+     * @param idx Resulting index, only set on success.
+     * @return std::errc() on success, std::errc::invalid_argument if val isn't a number
+     *         or std::errc::result_out_of_range if it isn't representable as a float.
+     */
+    static std::errc indexFromOscString(std::string_view val, uint& idx)
+    {
+        int key = 0;
+        if (LevelTables<N>::oscKey(val, key)) {
+	  idx = levelTables<N>.osc_index[key - LevelTables<N>::OSC_KEY_MIN];
+	  return std::errc();
+        }
+        if (val == "-oo") {
+	  idx = 0;
+	  return std::errc();
+        }
+
+        // Same leniency as std::stof(): leading white space, a '+' sign and trailing garbage.
+        const char* first = val.data();
+        const char* last = first + val.size();
+        while (first != last && std::isspace(static_cast<unsigned char>(*first))) {
+	  ++first;
+        }
+        if (first != last && *first == '+') {
+	  ++first;
+	  if (first != last && *first == '-') {
+	    return std::errc::invalid_argument;
+	  }
+        }
+        float db = 0;
+        auto result = std::from_chars(first, last, db);
+        if (result.ec != std::errc()) {
+	  return result.ec;
+        }
+
+        idx = indexFromDb(db);
+        return std::errc();
     }
 
     /**
@@ -157,39 +428,59 @@ public:
      * @return OSC string, in this case the dB value as string.
      */
     std::string getOscString() const {
-      float dB = getDb();
-
-      std::string dbString;
-      if (dB == -144.f) {
-	dbString = "-oo";
-      } else {
-	 std::string sign = dB < 0 ? "-" : "+";
-	 if (dB < 0) {
-	   dB = -dB;
-	 }
-	 float rounded = static_cast<int>(10 * dB + 0.5f) * 0.1f;
-	 int dbInt = static_cast<int>(rounded);
-	 int fractional = 10 * rounded - 10 * static_cast<int>(rounded) ;
-	 if (dbInt == 0 && fractional == 0) {
-	   sign = "";
-	 }
-	 dbString = sign + std::to_string(dbInt) + "." + std::to_string(fractional);
+      return std::string(getOscStringView());
+    }
+
+    /**
+     * @brief getOscStringView Get the OSC string representation of this level without
+     *        allocating. The view points into static storage and stays valid for the
+     *        lifetime of the program. Only for an index beyond N - 1, which setDb() can
+     *        produce for dB values above the fader range, it points into a thread local
+     *        buffer that the next such call on the same thread overwrites.
+     * @return OSC string, in this case the dB value as string.
+     */
+    std::string_view getOscStringView() const {
+      const uint idx = _idx;
+      if (idx < N) {
+	return std::string_view(levelTables<N>.osc[idx], levelTables<N>.osc_len[idx]);
+      }
+
+      thread_local char buf[16];
+      uint len = LevelTables<N>::formatOscString(LevelTables<N>::dbFromIndex(idx), buf);
+      return std::string_view(buf, len);
+    }
 
+    /**
+     * @brief writeOscString Write the OSC string representation of this level into a
+     *        caller provided buffer, including a terminating null character.
+     * @param buf Output buffer.
+     * @param size Size of the output buffer.
+     * @return Length of the string without terminator, 0 if the buffer is too small.
+     */
+    size_t writeOscString(char* buf, size_t size) const {
+      auto str = getOscStringView();
+      if (size <= str.size()) {
+	return 0;
       }
-      return dbString;
+      std::memcpy(buf, str.data(), str.size());
+      buf[str.size()] = '\0';
+      return str.size();
     }
 
     /**
      * @brief setOscString Set Level by OSC string
      * @param val Signed dB value as string, e.g. "-10.0" or "+2.0"
+     * @throws std::invalid_argument or std::out_of_range like std::stof()
      */
-    void setOscString(std::string val) {
-        if (val == "-oo") {
-            _idx = 0;
-        } else {
-            float db = std::stof(val);
-            setDb(db);
+    void setOscString(std::string_view val) {
+        uint idx = 0;
+        auto err = indexFromOscString(val, idx);
+        if (err == std::errc::invalid_argument) {
+            throw std::invalid_argument("Level::setOscString");
+        } else if (err != std::errc()) {
+            throw std::out_of_range("Level::setOscString");
         }
+        _idx = idx;
     }
 
     /**
@@ -213,6 +504,29 @@ public:
     }
 
 private:
+    /**
+     * @brief _truncate Same as static_cast<uint>(value) for values in [0, 2^32), but
+     *        built from signed conversions, which vector units provide.
+     */
+    static uint _truncate(float value)
+    {
+        const float two_31 = 2147483648.f;
+        bool high = value >= two_31;
+        float low = value - (high ? two_31 : 0.f);
+        return (high ? 0x80000000u : 0u) + static_cast<uint>(static_cast<int>(low));
+    }
+
+    /**
+     * @brief _toFloat Same as static_cast<float>(value), but built from signed
+     *        conversions. Both halves convert exactly, so the single rounding
+     *        happens in the addition.
+     */
+    static float _toFloat(uint value)
+    {
+        return static_cast<float>(static_cast<int>(value >> 16)) * 65536.f
+	  + static_cast<float>(static_cast<int>(value & 0xffff));
+    }
+
     std::atomic<uint> _idx; // We use an atomic here so we
 };
 
@@ -0,0 +1,362 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ */
+
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "xrm32level.hpp"
+
+namespace Xrm32 {
+
+/**
+ * @brief The smallest unsigned integer type holding all indices of a Level<N>.
+ */
+template<uint N>
+using LevelIndex = std::conditional_t<(N <= 0x100), uint8_t,
+					std::conditional_t<(N <= 0x10000), uint16_t, uint32_t>>;
+
+/**
+ * @brief A fixed number of levels stored as a plain array of indices, e.g. all faders
+ *        of several mixers. Each level behaves exactly like a Level<N>: the conversions
+ *        are Level<N>'s own, so every getter returns what Level<N> would return after
+ *        the same setter call. The one exception are dB values above the fader range,
+ *        where setDb() clips to the top index like setIndex() does instead of storing
+ *        an index beyond N - 1.
+ *
+ *        Reads may run concurrently with writes, but only one thread may write at a
+ *        time. A single level is always read consistently. Ranges are read through a
+ *        sequence lock: the writer bumps a version before and after each write and
+ *        readers retry until they saw the same even version on both sides, so a
+ *        snapshot never mixes two writes. Unlike Level<N> a bank is copyable.
+ */
+template<uint N>
+class LevelBank {
+public:
+    typedef LevelIndex<N> Index;
+
+    /**
+     * @brief LevelBank
+     * @param size Number of levels.
+     * @param level Initial float level of all of them.
+     */
+    explicit LevelBank(size_t size, float level = 0.f) :
+      _indices(size, static_cast<Index>(Level<N>::indexFromFloat(level)))
+    {
+    }
+
+    LevelBank(const LevelBank& other) :
+      _indices(other.size())
+    {
+        other._read([this, &other]() {
+	  for (size_t i = 0; i < _indices.size(); ++i) {
+	    _indices[i] = _load(other._indices[i]);
+	  }
+	});
+    }
+
+    /**
+     * @brief operator= Copy a snapshot of another bank. This is a write. If the sizes
+     *        differ the storage is reallocated, which isn't safe while others read.
+     */
+    LevelBank& operator=(const LevelBank& other)
+    {
+        if (this != &other) {
+	  std::vector<uint> indices(other.size());
+	  other.getIndices(0, indices.data(), indices.size());
+	  _indices.resize(indices.size());
+	  setIndices(0, indices.data(), indices.size());
+        }
+        return *this;
+    }
+
+    /**
+     * @brief size Number of levels in the bank.
+     */
+    size_t size() const
+    {
+        return _indices.size();
+    }
+
+    /**
+     * @brief version Number of writes so far. Changes with every write.
+     */
+    uint64_t version() const
+    {
+        return _seq.load(std::memory_order_acquire) / 2;
+    }
+
+    static uint getNumSteps()
+    {
+        return N;
+    }
+
+    void setIndex(size_t i, uint index)
+    {
+        _write([this, i, index]() { _store(_indices.at(i), index); });
+    }
+
+    void setFloat(size_t i, float level)
+    {
+        setIndex(i, Level<N>::indexFromFloat(level));
+    }
+
+    void setDb(size_t i, float db)
+    {
+        setIndex(i, Level<N>::indexFromDb(db));
+    }
+
+    /**
+     * @brief setOscString Set a level by OSC string, e.g. "-10.0" or "+2.0".
+     * @throws std::invalid_argument or std::out_of_range like Level<N>::setOscString()
+     */
+    void setOscString(size_t i, std::string_view val)
+    {
+        uint idx = 0;
+        auto err = Level<N>::indexFromOscString(val, idx);
+        if (err == std::errc::invalid_argument) {
+            throw std::invalid_argument("LevelBank::setOscString");
+        } else if (err != std::errc()) {
+            throw std::out_of_range("LevelBank::setOscString");
+        }
+        setIndex(i, idx);
+    }
+
+    uint getIndex(size_t i) const
+    {
+        return _load(_indices.at(i));
+    }
+
+    float getFloat(size_t i) const
+    {
+        return static_cast<float>(getIndex(i)) / LevelTables<N>::DIVISOR;
+    }
+
+    float getDb(size_t i) const
+    {
+        return levelTables<N>.db[getIndex(i)];
+    }
+
+    /**
+     * @brief getOscStringView OSC string of a level. Points into static storage.
+     */
+    std::string_view getOscStringView(size_t i) const
+    {
+        uint idx = getIndex(i);
+        return std::string_view(levelTables<N>.osc[idx], levelTables<N>.osc_len[idx]);
+    }
+
+    /**
+     * @brief setIndices Set a range of levels by index in a single write.
+     * @param first Position of the first level.
+     * @param indices 'count' indices, clipped to N - 1 like Level<N>::setIndex() does.
+     * @throws std::out_of_range if the range exceeds the bank.
+     */
+    void setIndices(size_t first, const uint* indices, size_t count)
+    {
+        _check(first, count);
+        _write([this, first, indices, count]() {
+	  for (size_t i = 0; i < count; ++i) {
+	    _store(_indices[first + i], indices[i]);
+	  }
+	});
+    }
+
+    /**
+     * @brief setFloats Set a range of levels by float value in a single write.
+     */
+    void setFloats(size_t first, const float* flevels, size_t count)
+    {
+        _convertAndSet(first, flevels, count, [](const float* in, uint* out, size_t n) {
+	  Level<N>::indexFromFloat(in, out, n);
+	});
+    }
+
+    /**
+     * @brief setDbs Set a range of levels by dB value in a single write.
+     */
+    void setDbs(size_t first, const float* dbs, size_t count)
+    {
+        _convertAndSet(first, dbs, count, [](const float* in, uint* out, size_t n) {
+	  Level<N>::indexFromDb(in, out, n);
+	});
+    }
+
+    /**
+     * @brief getIndices Consistent snapshot of a range of indices.
+     * @return The version the snapshot belongs to.
+     * @throws std::out_of_range if the range exceeds the bank.
+     */
+    uint64_t getIndices(size_t first, uint* indices, size_t count) const
+    {
+        _check(first, count);
+        return _read([this, first, indices, count]() {
+	  for (size_t i = 0; i < count; ++i) {
+	    indices[i] = _load(_indices[first + i]);
+	  }
+	});
+    }
+
+    /**
+     * @brief getFloats Consistent snapshot of a range of float levels.
+     */
+    uint64_t getFloats(size_t first, float* flevels, size_t count) const
+    {
+        _check(first, count);
+        return _read([this, first, flevels, count]() {
+	  for (size_t i = 0; i < count; ++i) {
+	    flevels[i] = static_cast<float>(_load(_indices[first + i])) / LevelTables<N>::DIVISOR;
+	  }
+	});
+    }
+
+    /**
+     * @brief getDbs Consistent snapshot of a range of dB values.
+     */
+    uint64_t getDbs(size_t first, float* dbs, size_t count) const
+    {
+        _check(first, count);
+        return _read([this, first, dbs, count]() {
+	  for (size_t i = 0; i < count; ++i) {
+	    dbs[i] = levelTables<N>.db[_load(_indices[first + i])];
+	  }
+	});
+    }
+
+    /**
+     * @brief diff Compare a range to an earlier snapshot and bring the snapshot up to date.
+     *        The changes are collected on the stack and applied once the snapshot they
+     *        were read from has been validated. If more than CHUNK levels changed, each
+     *        CHUNK of them is read from a consistent snapshot of its own.
+     * @param first Position of the first level.
+     * @param previous 'count' indices as returned by getIndices(), updated in place.
+     * @param count Number of levels.
+     * @param changed Output, room for 'count' positions relative to 'first'. May be null.
+     * @return Number of levels whose index differs from 'previous'.
+     */
+    size_t diff(size_t first, uint* previous, size_t count, size_t* changed = nullptr) const
+    {
+        _check(first, count);
+        size_t num_changed = 0;
+        size_t positions[CHUNK];
+        uint indices[CHUNK];
+        for (size_t done = 0; done < count; ) {
+	  size_t n = 0, end = count;
+	  _read([this, first, previous, count, done, &positions, &indices, &n, &end]() {
+	      n = 0;
+	      end = count;
+	      for (size_t i = done; i < count; ++i) {
+		uint current = _load(_indices[first + i]);
+		if (current != previous[i]) {
+		  positions[n] = i;
+		  indices[n] = current;
+		  if (++n == CHUNK) {
+		    end = i + 1;
+		    break;
+		  }
+		}
+	      }
+	    });
+	  for (size_t i = 0; i < n; ++i) {
+	    previous[positions[i]] = indices[i];
+	    if (changed) {
+	      changed[num_changed + i] = positions[i];
+	    }
+	  }
+	  num_changed += n;
+	  done = end;
+        }
+        return num_changed;
+    }
+
+private:
+    // Conversion and diff batch size, keeps the intermediate indices on the stack
+    static constexpr size_t CHUNK = 256;
+
+    std::vector<Index> _indices;
+    // Sequence lock, odd while a write is in progress
+    std::atomic<uint64_t> _seq{0};
+
+    static uint _load(const Index& idx)
+    {
+        return std::atomic_ref<const Index>(idx).load(std::memory_order_relaxed);
+    }
+
+    static void _store(Index& idx, uint value)
+    {
+        Index clipped = static_cast<Index>(value > N - 1 ? N - 1 : value);
+        std::atomic_ref<Index>(idx).store(clipped, std::memory_order_relaxed);
+    }
+
+    void _check(size_t first, size_t count) const
+    {
+        if (first > _indices.size() || count > _indices.size() - first) {
+            throw std::out_of_range("LevelBank: range exceeds bank");
+        }
+    }
+
+    template<typename Write>
+    void _write(Write write)
+    {
+        uint64_t seq = _seq.load(std::memory_order_relaxed);
+        _seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        write();
+        _seq.store(seq + 2, std::memory_order_release);
+    }
+
+    template<typename Read>
+    uint64_t _read(Read read) const
+    {
+        for (;;) {
+	  uint64_t seq = _seq.load(std::memory_order_acquire);
+	  if (seq & 1) {
+	    std::this_thread::yield();
+	    continue;
+	  }
+	  read();
+	  std::atomic_thread_fence(std::memory_order_acquire);
+	  if (_seq.load(std::memory_order_relaxed) == seq) {
+	    return seq / 2;
+	  }
+        }
+    }
+
+    template<typename Convert>
+    void _convertAndSet(size_t first, const float* values, size_t count, Convert convert)
+    {
+        _check(first, count);
+        _write([this, first, values, count, &convert]() {
+	  uint indices[CHUNK];
+	  for (size_t done = 0; done < count; done += CHUNK) {
+	    size_t n = std::min(CHUNK, count - done);
+	    convert(values + done, indices, n);
+	    for (size_t i = 0; i < n; ++i) {
+	      _store(_indices[first + done + i], indices[i]);
+	    }
+	  }
+	});
+    }
+};
+
+}
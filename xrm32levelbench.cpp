@@ -0,0 +1,375 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "xrm32level.hpp"
+#include "xrm32levelbank.hpp"
+#include "xrm32meter.hpp"
+
+// Count every heap allocation made by the benchmarked code.
+static size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+  ++allocations;
+  if (void* ptr = std::malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+// Keeps the compiler from optimizing the benchmarked calls away.
+static volatile size_t sink = 0;
+
+struct Result {
+  std::string name;
+  double ns_per_op;
+  double allocs_per_call;
+};
+
+static std::vector<Result> results;
+static uint repetitions = 15;
+static double scale = 1.0; // Applied to all iteration counts
+
+/**
+ * @brief bench Run 'op' for 'iterations' times, 'repetitions' times over, and print
+ *        and record the fastest run's ns/op and the allocations per call of 'op'. For
+ *        batch operations 'elements' is the number of values converted per call and
+ *        the time is reported per value. Allocations are always counted per call, so a
+ *        single one in a batch call doesn't vanish behind the number of values.
+ */
+template<typename Op>
+void bench(const std::string& name, uint iterations, Op op, uint elements = 1)
+{
+  iterations = std::max(1u, static_cast<uint>(iterations * scale));
+  double best_ns = 0;
+  size_t allocs = 0;
+  for (uint r = 0; r < repetitions; ++r) {
+    size_t allocations_before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    size_t acc = 0;
+    for (uint i = 0; i < iterations; ++i) {
+      acc += op(i);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    allocs = allocations - allocations_before;
+    sink = sink + acc;
+
+    double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    best_ns = r == 0 ? ns : std::min(best_ns, ns);
+  }
+
+  double ops = static_cast<double>(iterations) * elements;
+  double allocs_per_call = static_cast<double>(allocs) / iterations;
+  results.push_back(Result{name, best_ns / ops, allocs_per_call});
+  std::cout << std::left << std::setw(40) << name << std::right
+	    << std::setw(10) << std::fixed << std::setprecision(2) << best_ns / ops << " ns/op"
+	    << std::setw(10) << allocs_per_call << " allocs/call"
+	    << std::endl;
+}
+
+/**
+ * @brief benchLevel The per-level operations of Level<N>.
+ */
+template<uint N>
+void benchLevel(uint iterations)
+{
+  const std::string prefix = "Level<" + std::to_string(N) + ">::";
+  Xrm32::Level<N> level;
+
+  // The getters read levels set up front, so only the getter itself is timed and
+  // not an atomic store to set the level first.
+  std::vector<Xrm32::Level<N>> levels(N);
+  std::vector<float> flevels(N), dbs(N);
+  for (uint i = 0; i < N; ++i) {
+    levels[i].setIndex(i);
+    flevels[i] = static_cast<float>(i) / (N - 1);
+    dbs[i] = Xrm32::levelTables<N>.db[i];
+  }
+
+  bench(prefix + "setFloat", iterations, [&level, &flevels](uint i) {
+      level.setFloat(flevels[i % N]);
+      return level.getIndex();
+    });
+
+  bench(prefix + "getFloat", iterations, [&levels](uint i) {
+      return static_cast<size_t>(levels[i % N].getFloat() * N);
+    });
+
+  bench(prefix + "getDb", iterations, [&levels](uint i) {
+      return static_cast<size_t>(-levels[i % N].getDb());
+    });
+
+  bench(prefix + "indexFromDb", iterations, [&dbs](uint i) {
+      return Xrm32::Level<N>::indexFromDb(dbs[i % N]);
+    });
+
+  bench(prefix + "getOscString", iterations, [&levels](uint i) {
+      return levels[i % N].getOscString().size();
+    });
+
+  bench(prefix + "setOscString", iterations, [&level](uint i) {
+      level.setOscString(Xrm32::levelTables<N>.osc[i % N]);
+      return level.getIndex();
+    });
+}
+
+static std::string json()
+{
+  std::ostringstream json;
+  json << "{\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    json << (i > 0 ? "," : "") << "\n    {\"name\": \"" << results[i].name
+	 << "\", \"ns_per_op\": " << results[i].ns_per_op
+	 << ", \"allocs_per_call\": " << std::setprecision(17) << results[i].allocs_per_call
+	 << std::setprecision(6) << "}";
+  }
+  json << "\n  ]\n}\n";
+  return json.str();
+}
+
+/**
+ * @brief loadBaseline Read results as written by json(), one per line.
+ */
+static std::map<std::string, Result> loadBaseline(const std::string& path)
+{
+  std::map<std::string, Result> baseline;
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("Can't read baseline " + path);
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    char name[256];
+    Result result;
+    if (std::sscanf(line.c_str(), " {\"name\": \"%255[^\"]\", \"ns_per_op\": %lf, \"allocs_per_call\": %lf",
+		    name, &result.ns_per_op, &result.allocs_per_call) == 3) {
+      result.name = name;
+      baseline[result.name] = result;
+    }
+  }
+  return baseline;
+}
+
+/**
+ * @brief compare Compare the results to a baseline.
+ * @param threshold Allowed slowdown in percent.
+ * @return Number of regressions. Any additional allocation counts as one, there's no
+ *         threshold for allocations.
+ */
+static uint compare(const std::map<std::string, Result>& baseline, double threshold)
+{
+  uint regressions = 0;
+  std::cout << "\nCompared to the baseline (threshold " << threshold << " %):" << std::endl;
+  for (const auto& result : results) {
+    auto base = baseline.find(result.name);
+    if (base == baseline.end()) {
+      std::cout << std::left << std::setw(40) << result.name << "  not in baseline" << std::endl;
+      continue;
+    }
+    double change = 100 * (result.ns_per_op / base->second.ns_per_op - 1);
+    bool slower = change > threshold;
+    bool allocates = result.allocs_per_call > base->second.allocs_per_call;
+    if (slower || allocates) {
+      ++regressions;
+    }
+    std::cout << std::left << std::setw(40) << result.name << std::right
+	      << std::setw(10) << std::showpos << change << std::noshowpos << " %"
+	      << (slower ? "  SLOWER" : "") << (allocates ? "  ALLOCATES" : "") << std::endl;
+  }
+  std::cout << regressions << " regressions." << std::endl;
+  return regressions;
+}
+
+static void usage(const char* name)
+{
+  std::cout << "Usage: " << name << " [options]"
+	    << "\n  --json FILE        Write the results to FILE"
+	    << "\n  --baseline FILE    Compare to the results in FILE, fail on regressions"
+	    << "\n  --threshold PCT    Allowed slowdown against the baseline (default 20)"
+	    << "\n  --repetitions N    Runs per benchmark, the fastest counts (default 15)"
+	    << "\n  --scale F          Factor for all iteration counts (default 1)"
+	    << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  std::string json_path, baseline_path;
+  double threshold = 20;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--json" && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (arg == "--baseline" && i + 1 < argc) {
+      baseline_path = argv[++i];
+    } else if (arg == "--threshold" && i + 1 < argc) {
+      threshold = std::stod(argv[++i]);
+    } else if (arg == "--repetitions" && i + 1 < argc) {
+      repetitions = std::max(1ul, std::stoul(argv[++i]));
+    } else if (arg == "--scale" && i + 1 < argc) {
+      scale = std::stod(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? 0 : -1;
+    }
+  }
+
+  // Read the baseline first, a missing one shouldn't cost a whole run.
+  std::map<std::string, Result> baseline;
+  if (!baseline_path.empty()) {
+    try {
+      baseline = loadBaseline(baseline_path);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
+  }
+
+  const uint iterations = 400000;
+  benchLevel<256>(iterations);
+  benchLevel<1024>(iterations);
+  benchLevel<4096>(iterations);
+
+  const uint N = 1024;
+  Xrm32::Level<N> level;
+  std::vector<Xrm32::Level<N>> levels(N);
+  for (uint i = 0; i < N; ++i) {
+    levels[i].setIndex(i);
+  }
+
+  bench("getOscStringView", iterations, [&levels](uint i) {
+      return levels[i % N].getOscStringView().size();
+    });
+
+  char buf[Xrm32::LevelTables<N>::OSC_STRING_SIZE];
+  bench("writeOscString", iterations, [&levels, &buf](uint i) {
+      return levels[i % N].writeOscString(buf, sizeof(buf));
+    });
+
+  bench("setOscString (non-canonical)", iterations, [&level](uint i) {
+      level.setOscString(i & 1 ? "-10.00" : "+2.50");
+      return level.getIndex();
+    });
+
+  // Batch conversions, reported per element
+  const uint batch = 1024;
+  std::vector<float> flevels(batch), dbs(batch);
+  std::vector<uint> indices(batch);
+  for (uint i = 0; i < batch; ++i) {
+    flevels[i] = static_cast<float>(i) / (batch - 1);
+  }
+
+  bench("indexFromFloat (batch)", iterations / batch, [&flevels, &indices](uint) {
+      Xrm32::Level<N>::indexFromFloat(flevels.data(), indices.data(), batch);
+      return indices[batch / 2];
+    }, batch);
+
+  bench("dbFromIndex (batch)", iterations / batch, [&indices, &dbs](uint) {
+      Xrm32::Level<N>::dbFromIndex(indices.data(), dbs.data(), batch);
+      return static_cast<size_t>(dbs[batch / 2]);
+    }, batch);
+
+  bench("indexFromDb (batch)", iterations / batch, [&dbs, &indices](uint) {
+      Xrm32::Level<N>::indexFromDb(dbs.data(), indices.data(), batch);
+      return indices[batch / 2];
+    }, batch);
+
+  // A bank of 8 mixers with 128 levels each, reported per level
+  Xrm32::LevelBank<N> bank(batch);
+  bench("LevelBank::setFloats", iterations / batch, [&bank, &flevels](uint) {
+      bank.setFloats(0, flevels.data(), batch);
+      return bank.version();
+    }, batch);
+
+  bench("LevelBank::getIndices", iterations / batch, [&bank, &indices](uint) {
+      bank.getIndices(0, indices.data(), batch);
+      return indices[batch / 2];
+    }, batch);
+
+  std::vector<uint> previous(batch);
+  bench("LevelBank::diff", iterations / batch, [&bank, &previous](uint i) {
+      bank.setIndex(i % batch, i % N);
+      return bank.diff(0, previous.data(), batch);
+    }, batch);
+
+  // Meter blobs as sent by the consoles, reported per value
+  std::vector<unsigned char> blob(4 + 2 * batch);
+  uint32_t num_values = batch;
+  std::memcpy(blob.data(), &num_values, sizeof(num_values));
+  for (uint i = 0; i < batch; ++i) {
+    int16_t value = static_cast<int16_t>(-static_cast<int>(i) * 32);
+    std::memcpy(blob.data() + 4 + 2 * i, &value, sizeof(value));
+  }
+
+  bench("Meter::decode (batch)", iterations / batch, [&blob, &dbs](uint) {
+      size_t count;
+      Xrm32::Meter::decode(blob.data(), blob.size(), dbs.data(), batch, count);
+      return count;
+    }, batch);
+
+  Xrm32::MeterBuffer meters(batch);
+  bench("MeterBuffer::publish", iterations / batch, [&meters, &blob](uint) {
+      meters.publish(blob.data(), blob.size());
+      return meters.frame();
+    }, batch);
+
+  bench("MeterBuffer::getIndices", iterations / batch, [&meters, &indices](uint) {
+      return meters.getIndices<N>(indices.data(), batch);
+    }, batch);
+
+  if (!json_path.empty()) {
+    std::ofstream out(json_path);
+    out << json();
+    if (!out) {
+      std::cerr << "Can't write " << json_path << std::endl;
+      return -1;
+    }
+  }
+
+  if (!baseline_path.empty() && compare(baseline, threshold) > 0) {
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,460 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This file is part of xmairleveltest.
+ *
+ *  xmairleveltest is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with xmairleveltest.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Offline verification of Xrm32::Level's index rounding. Every float in [0, 1] is run
+// through the batch and the scalar indexFromFloat() and every dB value on a fine grid
+// through both indexFromDb(); batch and scalar results have to be identical. Both are
+// also compared to a reference mapping that evaluates the same formulas in double
+// precision. Those differences are caused by float rounding and expected, so they are
+// reported but don't fail the verification. The float sweep also counts disagreements
+// with Patrick-Gilles Maillot's roundf() formula, like main.cpp does for a few thousand
+// samples. Finally Xrm32::LevelBank is compared to Level for every index, the dB grid
+// and all canonical OSC strings, and its snapshots are checked for torn reads while
+// another thread writes. Xrm32::Meter's batch decoding is checked for every 16 bit
+// meter value, and so is Xrm32::MeterBuffer for torn reads. Only failures, i.e. batch
+// and scalar mismatches, torn reads and decoding errors, make the program exit with 1.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "xrm32level.hpp"
+#include "xrm32levelbank.hpp"
+#include "xrm32meter.hpp"
+
+const uint N = 1024;
+const uint MAX_EXAMPLES = 10; // Failures and differences printed per check
+
+struct Disagreement {
+  float value;
+  uint index;      // Xrm32::Level's result
+  uint reference;  // Expected result
+};
+
+struct CheckResult {
+  uint64_t checked = 0;
+  uint64_t failures = 0;                 // Wrong results, fail the verification
+  uint64_t differences = 0;              // Float vs. double precision, expected
+  uint64_t roundf_disagreements = 0;
+  std::vector<Disagreement> failure_examples, difference_examples;
+
+  void merge(const CheckResult& other)
+  {
+    checked += other.checked;
+    failures += other.failures;
+    differences += other.differences;
+    roundf_disagreements += other.roundf_disagreements;
+    failure_examples.insert(failure_examples.end(), other.failure_examples.begin(),
+			    other.failure_examples.end());
+    difference_examples.insert(difference_examples.end(), other.difference_examples.begin(),
+			       other.difference_examples.end());
+  }
+
+  void fail(float value, uint index, uint reference)
+  {
+    ++failures;
+    if (failure_examples.size() < MAX_EXAMPLES) {
+      failure_examples.push_back(Disagreement{value, index, reference});
+    }
+  }
+
+  void differ(float value, uint index, uint reference)
+  {
+    ++differences;
+    if (difference_examples.size() < MAX_EXAMPLES) {
+      difference_examples.push_back(Disagreement{value, index, reference});
+    }
+  }
+};
+
+/**
+ * @brief referenceFromFloat Level::indexFromFloat() in double precision.
+ */
+static uint referenceFromFloat(float flevel)
+{
+  double level = std::min(std::max(static_cast<double>(flevel), 0.0), 1.0);
+  double idx = std::floor(level * (N - 1 + 0.5));
+  return idx > N - 1 ? N - 1 : static_cast<uint>(idx);
+}
+
+/**
+ * @brief referenceFromDb Level::indexFromDb() in double precision.
+ */
+static uint referenceFromDb(float db_float)
+{
+  double db = db_float;
+  double level = 0;
+  if (db >= (40.0 * N) / (2 * (N - 1)) - 30) {
+    level = (db + 30) / 40;
+  } else if (db >= (80.0 * N) / (4 * (N - 1)) - 50) {
+    level = (db + 50) / 80;
+  } else if (db >= (160.0 * N) / (16 * (N - 1)) - 70) {
+    level = (db + 70) / 160;
+  } else if (db > -90) {
+    level = (db + 90) / 480;
+  }
+  return static_cast<uint>(std::floor(level * (N - 1 + 0.5)));
+}
+
+/**
+ * @brief checkFloats Check all floats whose bit patterns lie in [first, last).
+ */
+static CheckResult checkFloats(uint32_t first, uint32_t last)
+{
+  const uint batch = 4096;
+  CheckResult result;
+  float flevels[batch];
+  uint indices[batch];
+
+  for (uint32_t bits = first; bits < last; ) {
+    uint count = static_cast<uint>(std::min<uint32_t>(batch, last - bits));
+    for (uint i = 0; i < count; ++i) {
+      uint32_t b = bits + i;
+      std::memcpy(&flevels[i], &b, sizeof(float));
+    }
+    Xrm32::Level<N>::indexFromFloat(flevels, indices, count);
+
+    for (uint i = 0; i < count; ++i) {
+      uint scalar = Xrm32::Level<N>::indexFromFloat(flevels[i]);
+      if (indices[i] != scalar) {
+	result.fail(flevels[i], indices[i], scalar);
+      }
+      uint reference = referenceFromFloat(flevels[i]);
+      if (scalar != reference) {
+	result.differ(flevels[i], scalar, reference);
+      }
+      // Rounding according to p.110 of Maillot's X32 OSC documentation
+      float rounded = roundf(flevels[i] * (N - 1)) / (N - 1);
+      if (rounded != static_cast<float>(indices[i]) / (N - 1)) {
+	++result.roundf_disagreements;
+      }
+    }
+    result.checked += count;
+    bits += count;
+  }
+
+  return result;
+}
+
+/**
+ * @brief checkDbs Check the dB grid points min_db + i * step for i in [first, last).
+ */
+static CheckResult checkDbs(double min_db, double step, uint64_t first, uint64_t last)
+{
+  const uint batch = 4096;
+  CheckResult result;
+  float dbs[batch];
+  uint indices[batch];
+
+  for (uint64_t i = first; i < last; ) {
+    uint count = static_cast<uint>(std::min<uint64_t>(batch, last - i));
+    for (uint k = 0; k < count; ++k) {
+      dbs[k] = static_cast<float>(min_db + (i + k) * step);
+    }
+    Xrm32::Level<N>::indexFromDb(dbs, indices, count);
+
+    for (uint k = 0; k < count; ++k) {
+      uint scalar = Xrm32::Level<N>::indexFromDb(dbs[k]);
+      if (indices[k] != scalar) {
+	result.fail(dbs[k], indices[k], scalar);
+      }
+      uint reference = referenceFromDb(dbs[k]);
+      if (scalar != reference) {
+	result.differ(dbs[k], scalar, reference);
+      }
+    }
+    result.checked += count;
+    i += count;
+  }
+
+  return result;
+}
+
+/**
+ * @brief parallel Split [0, total) into one chunk per thread and merge the results.
+ */
+template<typename Check>
+static CheckResult parallel(uint num_threads, uint64_t total, Check check)
+{
+  std::vector<CheckResult> results(num_threads);
+  std::vector<std::thread> threads;
+  uint64_t chunk = (total + num_threads - 1) / num_threads;
+
+  for (uint t = 0; t < num_threads; ++t) {
+    uint64_t first = std::min(total, t * chunk);
+    uint64_t last = std::min(total, first + chunk);
+    threads.emplace_back([&results, t, first, last, &check]() {
+	results[t] = check(first, last);
+      });
+  }
+
+  CheckResult result;
+  for (uint t = 0; t < num_threads; ++t) {
+    threads[t].join();
+    result.merge(results[t]);
+  }
+  result.failure_examples.resize(std::min<size_t>(result.failure_examples.size(), MAX_EXAMPLES));
+  result.difference_examples.resize(std::min<size_t>(result.difference_examples.size(), MAX_EXAMPLES));
+
+  return result;
+}
+
+/**
+ * @brief checkBank Compare LevelBank's conversions to Level's.
+ */
+static CheckResult checkBank(double min_db, double step, uint64_t num_dbs)
+{
+  CheckResult result;
+  Xrm32::Level<N> level;
+  Xrm32::LevelBank<N> bank(N);
+
+  auto compare = [&result, &level, &bank](float value, size_t i) {
+    ++result.checked;
+    if (bank.getIndex(i) != level.getIndex() || bank.getFloat(i) != level.getFloat()
+	|| bank.getDb(i) != level.getDb() || bank.getOscStringView(i) != level.getOscStringView()) {
+      result.fail(value, bank.getIndex(i), level.getIndex());
+    }
+  };
+
+  std::vector<uint> indices(N);
+  std::vector<float> flevels(N), dbs(N);
+  for (uint idx = 0; idx < N; ++idx) {
+    indices[idx] = idx;
+    flevels[idx] = static_cast<float>(idx) / (N - 1);
+  }
+  bank.setIndices(0, indices.data(), N);
+  bank.getDbs(0, dbs.data(), N);
+  for (uint idx = 0; idx < N; ++idx) {
+    level.setIndex(idx);
+    compare(idx, idx);
+    if (dbs[idx] != level.getDb()) {
+      result.fail(idx, idx, idx);
+    }
+    auto osc = level.getOscStringView();
+    bank.setOscString(idx, osc);
+    level.setOscString(osc);
+    compare(idx, idx);
+  }
+  bank.setFloats(0, flevels.data(), N);
+  for (uint idx = 0; idx < N; ++idx) {
+    level.setFloat(flevels[idx]);
+    compare(flevels[idx], idx);
+  }
+
+  // The bank clips dB values above the fader range, see LevelBank.
+  for (uint64_t i = 0; i < num_dbs; ++i) {
+    float db = static_cast<float>(min_db + i * step);
+    level.setDb(db);
+    if (level.getIndex() > N - 1) {
+      break;
+    }
+    bank.setDb(0, db);
+    compare(db, 0);
+  }
+
+  // Snapshots of a bank written by another thread are never mixed.
+  std::fill(indices.begin(), indices.end(), 0);
+  bank.setIndices(0, indices.data(), N);
+  std::atomic<bool> done{false};
+  std::thread writer([&bank, &done]() {
+      std::vector<uint> all(N);
+      for (uint round = 0; round < 20000; ++round) {
+	std::fill(all.begin(), all.end(), round % N);
+	bank.setIndices(0, all.data(), N);
+      }
+      done = true;
+    });
+  uint64_t torn = 0;
+  while (!done) {
+    bank.getIndices(0, indices.data(), N);
+    ++result.checked;
+    if (std::count(indices.begin(), indices.end(), indices.front()) != N) {
+      ++torn;
+    }
+  }
+  writer.join();
+  if (torn > 0) {
+    result.fail(0, torn, 0);
+  }
+
+  return result;
+}
+
+/**
+ * @brief checkMeters Compare Meter's batch decoding of every meter value to the
+ *        definition and its indices to Level's.
+ */
+static CheckResult checkMeters()
+{
+  CheckResult result;
+  const uint num_values = 0x10000;
+
+  // All values in a single blob, little endian
+  std::vector<unsigned char> blob(4 + 2 * num_values);
+  blob[0] = num_values & 0xff;
+  blob[1] = (num_values >> 8) & 0xff;
+  blob[2] = (num_values >> 16) & 0xff;
+  for (uint v = 0; v < num_values; ++v) {
+    blob[4 + 2 * v] = v & 0xff;
+    blob[4 + 2 * v + 1] = v >> 8;
+  }
+
+  std::vector<float> dbs(num_values);
+  std::vector<uint> indices(num_values);
+  size_t count = 0;
+  if (!Xrm32::Meter::decode(blob.data(), blob.size(), dbs.data(), num_values, count)
+      || count != num_values) {
+    result.fail(0, count, num_values);
+    return result;
+  }
+  Xrm32::Meter::indexFromDb<N>(dbs.data(), indices.data(), num_values);
+  for (uint v = 0; v < num_values; ++v) {
+    ++result.checked;
+    double db = static_cast<int16_t>(v) / 256.0;
+    uint reference = std::min(Xrm32::Level<N>::indexFromDb(static_cast<float>(db)), N - 1);
+    if (dbs[v] != db || indices[v] != reference
+	|| Xrm32::Meter::indexFromDb<N>(dbs[v]) != reference) {
+      result.fail(dbs[v], indices[v], reference);
+    }
+  }
+
+  // A blob shorter than its count says is rejected
+  if (Xrm32::Meter::decode(blob.data(), blob.size() - 1, dbs.data(), num_values, count)) {
+    result.fail(0, 0, num_values);
+  }
+
+  // Frames of a buffer published by another thread are never mixed.
+  const size_t frame_size = 40;
+  Xrm32::MeterBuffer buffer(frame_size);
+  std::atomic<bool> done{false};
+  std::thread writer([&buffer, &done, frame_size]() {
+      std::vector<unsigned char> frame(4 + 2 * frame_size);
+      frame[0] = frame_size;
+      for (uint round = 0; round < 200000; ++round) {
+	for (size_t i = 0; i < frame_size; ++i) {
+	  frame[4 + 2 * i] = round & 0xff;
+	  frame[4 + 2 * i + 1] = (round >> 8) & 0x7f;
+	}
+	buffer.publish(frame.data(), frame.size());
+      }
+      done = true;
+    });
+  uint64_t torn = 0;
+  std::vector<float> frame(frame_size);
+  while (!done) {
+    size_t n = buffer.getDbs(frame.data(), frame_size);
+    ++result.checked;
+    if (std::count(frame.begin(), frame.begin() + n, frame.front()) != static_cast<long>(n)) {
+      ++torn;
+    }
+  }
+  writer.join();
+  if (torn > 0) {
+    result.fail(0, torn, 0);
+  }
+
+  return result;
+}
+
+static void report(const char* name, const CheckResult& result, double seconds)
+{
+  std::cout << name << ": checked " << result.checked << " values in " << seconds << " s, "
+	    << result.failures << " failures, " << result.differences
+	    << " expected differences to the double precision reference." << std::endl;
+  for (const auto& d : result.failure_examples) {
+    std::cout << "  FAILED value: " << d.value << "   index: " << d.index
+	      << "   expected: " << d.reference << std::endl;
+  }
+  for (const auto& d : result.difference_examples) {
+    std::cout << "  value: " << d.value << "   index: " << d.index
+	      << "   reference: " << d.reference << std::endl;
+  }
+}
+
+static void usage(const char* name)
+{
+  std::cout << "Usage: " << name << " [options]"
+	    << "\n  --threads N     Number of threads (default: all cores)"
+	    << "\n  --db-step DB    Spacing of the dB grid (default 0.0001)"
+	    << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  uint num_threads = std::max(1u, std::thread::hardware_concurrency());
+  double db_step = 0.0001;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      num_threads = std::max(1ul, std::stoul(argv[++i]));
+    } else if (arg == "--db-step" && i + 1 < argc) {
+      db_step = std::stod(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? 0 : -1;
+    }
+  }
+
+  std::cout << "Verifying Xrm32::Level<" << N << "> on " << num_threads << " threads." << std::endl;
+
+  // All floats in [0, 1]. Positive floats are ordered like their bit patterns.
+  uint32_t one_bits;
+  const float one = 1.0f;
+  std::memcpy(&one_bits, &one, sizeof(float));
+
+  auto start = std::chrono::steady_clock::now();
+  auto floats = parallel(num_threads, uint64_t(one_bits) + 1, [](uint64_t first, uint64_t last) {
+      return checkFloats(static_cast<uint32_t>(first), static_cast<uint32_t>(last));
+    });
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  report("indexFromFloat", floats, elapsed.count());
+  std::cout << "  roundf() rounding didn't match " << floats.roundf_disagreements << " times." << std::endl;
+
+  // dB grid covering the whole fader range and a bit beyond
+  const double min_db = -100, max_db = 20;
+  uint64_t num_dbs = static_cast<uint64_t>((max_db - min_db) / db_step) + 1;
+
+  start = std::chrono::steady_clock::now();
+  auto dbs = parallel(num_threads, num_dbs, [min_db, db_step](uint64_t first, uint64_t last) {
+      return checkDbs(min_db, db_step, first, last);
+    });
+  elapsed = std::chrono::steady_clock::now() - start;
+  report("indexFromDb", dbs, elapsed.count());
+
+  start = std::chrono::steady_clock::now();
+  auto bank = checkBank(min_db, 0.001, static_cast<uint64_t>((max_db - min_db) / 0.001) + 1);
+  elapsed = std::chrono::steady_clock::now() - start;
+  report("LevelBank", bank, elapsed.count());
+
+  start = std::chrono::steady_clock::now();
+  auto meters = checkMeters();
+  elapsed = std::chrono::steady_clock::now() - start;
+  report("Meter", meters, elapsed.count());
+
+  return floats.failures + dbs.failures + bank.failures + meters.failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ */
+
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "xrm32level.hpp"
+
+namespace Xrm32 {
+
+/**
+ * @brief Decoding of the consoles' meter blobs. After "/meters ,s /meters/1" the console
+ *        sends bank /meters/1 for 10 seconds as a single blob argument on path
+ *        "/meters/1": a 32 bit count followed by that many signed 16 bit values in
+ *        1/256 dB, both little endian. Values range from -128 dB to just below +128 dB.
+ */
+class Meter {
+public:
+    static constexpr float DB_PER_STEP = 1.f / 256;
+
+    /**
+     * @brief count Number of values in a meter blob.
+     * @param blob The blob's contents.
+     * @param size The blob's size in bytes.
+     * @param count Output, number of values.
+     * @return false if the blob is shorter than its count says.
+     */
+    static bool count(const void* blob, size_t size, size_t& count)
+    {
+        if (size < 4) {
+            return false;
+        }
+        uint32_t n;
+        std::memcpy(&n, blob, sizeof(n));
+        if constexpr (std::endian::native == std::endian::big) {
+            n = __builtin_bswap32(n);
+        }
+        count = n;
+        return n <= (size - 4) / 2;
+    }
+
+    /**
+     * @brief decode Batch conversion of a meter blob to dB values. Branch free, so GCC
+     *        vectorizes it at -O3; results are exact.
+     * @param blob The blob's contents.
+     * @param size The blob's size in bytes.
+     * @param dbs Output, room for 'max' dB values.
+     * @param max Further values are ignored.
+     * @param count Output, number of values decoded.
+     * @return false if the blob is malformed.
+     */
+    static bool decode(const void* blob, size_t size, float* dbs, size_t max, size_t& count)
+    {
+        if (!Meter::count(blob, size, count)) {
+            return false;
+        }
+        count = std::min(count, max);
+        const unsigned char* values = static_cast<const unsigned char*>(blob) + 4;
+        for (size_t i = 0; i < count; ++i) {
+            uint16_t raw;
+            std::memcpy(&raw, values + 2 * i, sizeof(raw));
+            if constexpr (std::endian::native == std::endian::big) {
+                raw = __builtin_bswap16(raw);
+            }
+            dbs[i] = static_cast<int16_t>(raw) * DB_PER_STEP;
+        }
+        return true;
+    }
+
+    /**
+     * @brief indexFromDb Meter level as Level<N> index, the fader position showing the
+     *        same dB value. Levels above the fader range are clipped to N - 1 and
+     *        everything at or below -90 dB is index 0.
+     */
+    template<uint N>
+    static uint indexFromDb(float db)
+    {
+        uint idx = Level<N>::indexFromDb(db);
+        return idx > N - 1 ? N - 1 : idx;
+    }
+
+    /**
+     * @brief indexFromDb Batch version of indexFromDb(float) with identical results.
+     */
+    template<uint N>
+    static void indexFromDb(const float* dbs, uint* indices, size_t count)
+    {
+        Level<N>::indexFromDb(dbs, indices, count);
+        for (size_t i = 0; i < count; ++i) {
+            indices[i] = indices[i] > N - 1 ? N - 1 : indices[i];
+        }
+    }
+};
+
+/**
+ * @brief The latest values of a meter bank. One thread publishes decoded blobs, any
+ *        number of threads read them without locking.
+ *
+ *        Frames alternate between two buffers, so readers copy the last complete frame
+ *        while the next one is being written. Only a reader that is still copying when
+ *        the frame after next starts reuses its buffer has to retry; at the consoles'
+ *        meter rates that practically never happens. The writer never waits.
+ */
+class MeterBuffer {
+public:
+    /**
+     * @brief MeterBuffer
+     * @param capacity Maximum number of values per frame, further ones are dropped.
+     */
+    explicit MeterBuffer(size_t capacity = 128) :
+      _scratch(capacity)
+    {
+        _values[0].resize(capacity);
+        _values[1].resize(capacity);
+    }
+
+    MeterBuffer(const MeterBuffer&) = delete;
+    MeterBuffer& operator=(const MeterBuffer&) = delete;
+
+    size_t capacity() const
+    {
+        return _scratch.size();
+    }
+
+    /**
+     * @brief frame Number of frames published so far.
+     */
+    uint64_t frame() const
+    {
+        return _published.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief publish Decode a meter blob and make it the current frame. Only one thread
+     *        may publish.
+     * @return false if the blob is malformed, the current frame is kept then.
+     */
+    bool publish(const void* blob, size_t size)
+    {
+        size_t count;
+        if (!Meter::decode(blob, size, _scratch.data(), _scratch.size(), count)) {
+            return false;
+        }
+
+        uint64_t frame = _published.load(std::memory_order_relaxed) + 1;
+        std::vector<float>& values = _values[frame & 1];
+        _begun.store(frame, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < count; ++i) {
+            std::atomic_ref<float>(values[i]).store(_scratch[i], std::memory_order_relaxed);
+        }
+        _count[frame & 1].store(count, std::memory_order_relaxed);
+        _published.store(frame, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief getDbs Copy of the current frame.
+     * @param dbs Output, room for 'max' dB values.
+     * @param max Further values aren't copied.
+     * @param frame Output, the frame copied, 0 if none has been published yet. May be null.
+     * @return Number of values copied.
+     */
+    size_t getDbs(float* dbs, size_t max, uint64_t* frame = nullptr) const
+    {
+        return _read(max, frame, [dbs](const std::vector<float>& values, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                dbs[i] = std::atomic_ref<const float>(values[i]).load(std::memory_order_relaxed);
+            }
+        });
+    }
+
+    /**
+     * @brief getIndices Copy of the current frame as Level<N> indices, see
+     *        Meter::indexFromDb(). Doesn't allocate, however large the frame.
+     */
+    template<uint N>
+    size_t getIndices(uint* indices, size_t max, uint64_t* frame = nullptr) const
+    {
+        return _read(max, frame, [indices](const std::vector<float>& values, size_t count) {
+            float dbs[CHUNK];
+            for (size_t first = 0; first < count; first += CHUNK) {
+                size_t n = std::min(CHUNK, count - first);
+                for (size_t i = 0; i < n; ++i) {
+                    dbs[i] = std::atomic_ref<const float>(values[first + i]).load(std::memory_order_relaxed);
+                }
+                Meter::indexFromDb<N>(dbs, indices + first, n);
+            }
+        });
+    }
+
+private:
+    // Frames are converted to indices in pieces of this size on the stack
+    static constexpr size_t CHUNK = 256;
+
+    std::vector<float> _values[2];
+    std::atomic<uint32_t> _count[2] = {0, 0};
+    std::atomic<uint64_t> _published{0}, _begun{0};
+    std::vector<float> _scratch;   // Only used by the writer
+
+    /**
+     * @brief _read Hand the current frame's values to 'copy' until they haven't been
+     *        overwritten meanwhile. What copy() gets from a torn frame is discarded.
+     * @param copy Called with the frame's buffer and the number of values to copy.
+     */
+    template<typename Copy>
+    size_t _read(size_t max, uint64_t* frame, Copy copy) const
+    {
+        for (;;) {
+            uint64_t current = _published.load(std::memory_order_acquire);
+            size_t count = std::min<size_t>(_count[current & 1].load(std::memory_order_relaxed), max);
+            copy(_values[current & 1], count);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // The frame after next is the first to overwrite this buffer
+            if (_begun.load(std::memory_order_relaxed) <= current + 1) {
+                if (frame) {
+                    *frame = current;
+                }
+                return count;
+            }
+        }
+    }
+};
+
+} // namespace Xrm32
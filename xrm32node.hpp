@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2017 Felix Homann
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ */
+
+
+#pragma once
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace Xrm32 {
+
+/**
+ * @brief Parsing of replies to /node queries. The mixer answers on path "node" with
+ *        a single string of the form "/ch/12/mix/fader -10.0\n", i.e. the node's path
+ *        followed by its value(s).
+ */
+class NodeReply {
+public:
+
+    /**
+     * @brief split Split a /node reply into path and value without copying.
+     * @param reply The reply string.
+     * @param path Node path, e.g. "/ch/12/mix/fader".
+     * @param value Everything after the path with surrounding white space removed,
+     *        e.g. "-10.0".
+     * @return false if the reply doesn't start with a path followed by white space.
+     */
+    static bool split(std::string_view reply, std::string_view& path, std::string_view& value)
+    {
+        constexpr std::string_view white_space = " \t\r\n";
+
+        size_t path_end = reply.find_first_of(white_space);
+        if (path_end == 0 || path_end == std::string_view::npos || reply[0] != '/') {
+            return false;
+        }
+        path = reply.substr(0, path_end);
+
+        size_t value_start = reply.find_first_not_of(white_space, path_end);
+        if (value_start == std::string_view::npos) {
+            value = std::string_view();
+        } else {
+            size_t value_end = reply.find_last_not_of(white_space);
+            value = reply.substr(value_start, value_end + 1 - value_start);
+        }
+
+        return true;
+    }
+};
+
+/**
+ * @brief Dispatches /node replies to handlers registered for their paths.
+ */
+class NodeDispatcher {
+public:
+    typedef std::function<void(std::string_view path, std::string_view value)> Handler;
+
+    /**
+     * @brief add Register a handler for a node path. Replaces an existing one.
+     * @param path Node path, e.g. "/ch/12/mix/fader".
+     * @param handler Called with path and value of matching replies.
+     */
+    void add(const std::string& path, Handler handler)
+    {
+        _handlers[path] = std::move(handler);
+    }
+
+    /**
+     * @brief remove Unregister the handler of a node path.
+     */
+    void remove(std::string_view path)
+    {
+        auto it = _handlers.find(path);
+        if (it != _handlers.end()) {
+            _handlers.erase(it);
+        }
+    }
+
+    /**
+     * @brief dispatch Parse a /node reply and call the handler for its path.
+     *        Doesn't allocate.
+     * @param reply The reply string.
+     * @return true if a handler has been called.
+     */
+    bool dispatch(std::string_view reply) const
+    {
+        std::string_view path, value;
+        if (!NodeReply::split(reply, path, value)) {
+            return false;
+        }
+
+        auto it = _handlers.find(path);
+        if (it == _handlers.end()) {
+            return false;
+        }
+        it->second(path, value);
+
+        return true;
+    }
+
+private:
+    // std::less<> allows lookups by std::string_view
+    std::map<std::string, Handler, std::less<>> _handlers;
+};
+
+}